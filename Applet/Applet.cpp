@@ -19,6 +19,8 @@ OO   OO  OO      OO       OOOO   OOOOO     OOO
 #include "Applet.h"
 #include <FMDebug.h>
 
+FMCounter BadInput("badin");		// # input commands no Applet recognized
+
 ///	<summary>Add an Applet to the App's list.</summary>
 /// <param name="applet">The Applet to be added.</param>
 /// <remarks>The Setup method of the Applet is invoked as it is added.</remarks>
@@ -48,8 +50,19 @@ void App::AddApplet(Applet* applet)
 }
 
 ///	<summary>Run all of the Applets in the App's list.</summary>
+/// <remarks>While an Applet has claimed exclusive use of Run, only that Applet is Run.</remarks>
 void App::Run()
 {
+	if (Timing || FMTIMELINE_RECORDING)
+	{
+		RunTimed();
+		return;
+	}
+	if (Exclusive != NULL)
+	{
+		Exclusive->Run();
+		return;
+	}
 	Applet* a = List;
 	while (a != NULL)
 	{
@@ -58,6 +71,56 @@ void App::Run()
 	}
 }
 
+///	<summary>Run the Applets, timing each to find the slowest, and recording each on the timeline.</summary>
+void App::RunTimed()
+{
+	bool exclusive = Exclusive != NULL;
+	Applet* a = exclusive ? Exclusive : List;
+	Applet* slowest = NULL;
+	uint32_t most = 0;
+	uint32_t t = micros();
+	while (a != NULL)
+	{
+		FMTIMELINE_BEGIN(Run, a);
+		a->Run();
+		FMTIMELINE_END(Run, a);
+		uint32_t now = micros();
+		if (now - t >= most)
+		{
+			most = now - t;
+			slowest = a;
+		}
+		t = now;
+		a = exclusive ? NULL : a->Next;
+	}
+	Slowest = slowest;
+	SlowestMicros = most;
+}
+
+///	<summary>Claim exclusive use of Run for an Applet.</summary>
+/// <param name="applet">The Applet claiming Run.</param>
+/// <returns>True if the claim succeeded, false if another Applet holds a claim.</returns>
+/// <remarks>
+/// This lets an Applet with critical timing be polled as often as possible, without being delayed by other Applets.
+/// Other Applets, including those handling communications, are not Run until the claim is released,
+/// so a claim should be held only briefly.
+/// </remarks>
+bool App::Claim(Applet* applet)
+{
+	if (Exclusive != NULL && Exclusive != applet)
+		return false;
+	Exclusive = applet;
+	return true;
+}
+
+///	<summary>Release a claim for exclusive use of Run.</summary>
+/// <param name="applet">The Applet releasing its claim.</param>
+void App::Release(Applet* applet)
+{
+	if (Exclusive == applet)
+		Exclusive = NULL;
+}
+
 ///	<summary>Process a command string through all of the Applets until one successfully recognizes it.</summary>
 /// <param name="s">The command string to be processed.</param>
 /// <returns>True if an Applet recognized the command, otherwise false.</returns>
@@ -65,22 +128,38 @@ void App::Run()
 /// The string is passed to the Input function of the Applet whose Prefix matches the first character of the string.
 /// </remarks>
 bool App::Input(const String& s)
+{
+	return Input(s.c_str(), s.length());
+}
+
+///	<summary>Process a null-terminated command string through all of the Applets until one successfully recognizes it.</summary>
+/// <param name="s">The command string to be processed.</param>
+/// <param name="len">The length of the command string.</param>
+/// <returns>True if an Applet recognized the command, otherwise false.</returns>
+/// <remarks>
+/// This allows a command to be processed in place in an input buffer. Only the part of the string
+/// following the Prefix is copied, as the String passed to the Applet's Input function.
+/// </remarks>
+bool App::Input(const char* s, size_t len)
 {
 //	debug.println("Input: ", s);
-	if (s.length() > 1)
+	if (len > 1)
 	{
 		Applet* a = List;
 		while (a != NULL)
 		{
 			if (a->Prefix == s[0])
 			{
-				a->Input(s.substring(1));
+				FMTIMELINE_BEGIN(Input, a);
+				a->Input(String(s + 1));
+				FMTIMELINE_END(Input, a);
 				return true;
 			}
 			a = a->Next;
 		}
 	}
-	debug.println("Invalid App input: ", s);
+	++BadInput;
+	FMLOG_WARN(FMLOG_CAT_APP, "Invalid App input: ", s);
 	return false;
 }
 
@@ -92,11 +171,42 @@ bool App::Output(const String& s)
 //	debug.println("Output: ", s);
 	if (OutputApplet != NULL)
 	{
-		return OutputApplet->Output(s);
+		FMTIMELINE_BEGIN(Output, OutputApplet);
+		bool ok = OutputApplet->Output(s);
+		FMTIMELINE_END(Output, OutputApplet);
+		return ok;
 	}
 	return false;
 }
 
+///	<summary>Determine if the OutputApplet is linked to the controller.</summary>
+/// <returns>True if there's an OutputApplet and its link is up.</returns>
+bool App::Linked()
+{
+	return OutputApplet != NULL && OutputApplet->LinkUp();
+}
+
+///	<summary>Publish a change in the state of a communications Applet's link to the controller.</summary>
+/// <remarks>
+/// Called by the Applet whose link has gone up or down. This only matters if it changes whether the App is Linked,
+/// either directly, as the OutputApplet, or as the link carrying the OutputApplet's messages.
+/// Each Applet is notified of the change, and when the link comes up, each sends its snapshot of properties in one burst.
+/// </remarks>
+void App::LinkChanged()
+{
+	bool linked = Linked();
+	if (linked == WasLinked)
+		return;
+	WasLinked = linked;
+	for (Applet* a = List; a != NULL; a = a->Next)
+		a->LinkChanged(linked);
+	if (linked)
+	{
+		for (Applet* a = List; a != NULL; a = a->Next)
+			a->SendSnapshot();
+	}
+}
+
 ///	<summary>Find the (first) Applet with the specified Name.</summary>
 /// <param name="name">The Name to search for.</param>
 /// <returns>The Applet found, or NULL if none was found with the specified Name.</returns>
@@ -113,6 +223,19 @@ Applet*	App::FindApplet(const char* name)
 	return NULL;
 }
 
+///	<summary>Find the (first) Applet with the specified Prefix.</summary>
+/// <param name="prefix">The Prefix to search for.</param>
+/// <returns>The Applet found, or NULL if none was found with the specified Prefix.</returns>
+Applet*	App::FindApplet(char prefix)
+{
+	for (Applet* a = List; a != NULL; a = a->Next)
+	{
+		if (a->Prefix == prefix)
+			return a;
+	}
+	return NULL;
+}
+
 /// <summary>Process an input string.</summary>
 /// <param name="s">The input string.</param>
 /// <remarks>
@@ -148,7 +271,7 @@ void Applet::Input(const String& s)
 			}
 			else
 			{
-				debug.print(Name); debug.println(": Invalid property: ", s[1]);
+				FMLOG_IF(FMLOG_LEVEL_WARN, FMLOG_CAT_APP) { debug.print(Name); debug.println(F(": Invalid property: "), s[1]); }
 			}
 			return;
 		}
@@ -161,8 +284,13 @@ void Applet::Input(const String& s)
 
 /// <summary>Send a property value to Output.</summary>
 /// <param name="prop">The character code for the property to send.</param>
+/// <remarks>
+/// Nothing is formatted unless the Parent App is Linked to the controller.
+/// </remarks>
 void Applet::SendProp(char prop)
 {
+	if (!Parent->Linked())
+		return;
 	String v = GetProp(prop);			// get the value
 	if (v != NULL)
 	{
@@ -173,10 +301,20 @@ void Applet::SendProp(char prop)
 	}
 	else
 	{
-		debug.print(Name); debug.println(": Invalid property: ", prop);
+		FMLOG_IF(FMLOG_LEVEL_WARN, FMLOG_CAT_APP) { debug.print(Name); debug.println(F(": Invalid property: "), prop); }
 	}
 }
 
+/// <summary>Send the snapshot of the Applet's state, its SnapshotProps, to Output.</summary>
+void Applet::SendSnapshot()
+{
+	const char* p = SnapshotProps();
+	if (p == NULL)
+		return;
+	while (*p != '\0')
+		SendProp(*p++);
+}
+
 void Applet::TrimFloat(String& s)
 {
 	if (s.indexOf('.') == -1)
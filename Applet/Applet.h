@@ -31,6 +31,8 @@ class Applet;
 /// <remarks>
 /// The App object holds a list of Applets and provides a mechanism by which they are
 /// Setup from the main Arduino setup() and Run from the main Arduino loop().
+/// The App tracks whether the OutputApplet is Linked to the controller, so that Applets needn't format
+/// output that can't be sent. When the link comes up, each Applet sends a snapshot of its state to resync the controller.
 /// </remarks>
 class App
 {
@@ -39,14 +41,32 @@ public:
 	void	AddApplet(Applet* applet);
 	void	Run();
 	bool	Input(const String& s);
+	bool	Input(const char* s, size_t len);
 	bool	Output(const String& s);
 	Applet*	FindApplet(const char* name);
+	Applet*	FindApplet(char prefix);
+	bool	Linked();
+	void	LinkChanged();
+	bool	Claim(Applet* applet);
+	void	Release(Applet* applet);
 	// An applet used to send data to the outside world
 	Applet*	OutputApplet = NULL;
+	// Set to true to time each Applet's Run, to find the slowest in each pass
+	bool	Timing = false;
+	// The Applet that was slowest to Run in the last pass, when Timing
+	Applet*	Slowest = NULL;
+	// in us - the time the Slowest Applet took to Run
+	uint32_t SlowestMicros = 0;
 
 protected:
 	// The list of Applets added
 	Applet*	List;
+	// An applet that has claimed exclusive use of Run, or NULL
+	Applet*	Exclusive = NULL;
+	// The Linked state last published to the Applets
+	bool	WasLinked = false;
+
+	void	RunTimed();
 };
 
 ///	<summary>An abstraction to encapsulate behavior for device functionality.</summary>
@@ -85,6 +105,20 @@ public:
 	/// </remarks>
 	virtual bool	Output(const String& s) { }
 
+	/// <summary>Determine if the Applet's link to the controller is up, if it provides outgoing communications.</summary>
+	/// <remarks>
+	/// Applets with a connection that comes and goes should override this, and report changes with App::LinkChanged.
+	/// </remarks>
+	virtual bool	LinkUp() { return true; }
+
+	/// <summary>Notification that the link to the controller has gone up or down.</summary>
+	/// <param name="linked">True if the link is up.</param>
+	virtual void	LinkChanged(bool linked) { }
+
+	/// <summary>Get the properties sent to the controller as a snapshot of the Applet's state.</summary>
+	/// <returns>The null-terminated list of property character codes, or NULL if none.</returns>
+	virtual const char*	SnapshotProps() { return NULL; }
+
 	/// <summary>Process a command string.</summary>
 	/// <remarks>
 	/// Applets that want to respond to incoming communications, other than property exchange,
@@ -104,6 +138,7 @@ public:
 	/// <summary>Send a property value to Output.</summary>
 	/// <param name="prop">The character code for the property to send.</param>
 	void			SendProp(char prop);
+	void			SendSnapshot();
 
 	void			TrimFloat(String& s);
 
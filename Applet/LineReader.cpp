@@ -0,0 +1,109 @@
+/*
+
+   O                      OOO              O
+  OOO                      OO             OO
+ OO OO                     OO             OO
+OO   OO OO OOO  OO OOO     OO    OOOOO  OOOOOO
+OO   OO  OO  OO  OO  OO    OO   OO   OO   OO
+OOOOOOO  OO  OO  OO  OO    OO   OOOOOOO   OO
+OO   OO  OO  OO  OO  OO    OO   OO        OO
+OO   OO  OOOOO   OOOOO     OO   OO   OO   OO OO
+OO   OO  OO      OO       OOOO   OOOOO     OOO
+         OO      OO
+        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "LineReader.h"
+#include <FMCounter.h>
+
+FMCounter LinesRead("lines");		// # input lines passed to an App
+FMCounter LinesDropped("linovf");	// # input lines discarded for being too long
+
+/// <summary>Determine if the Stream is due to be polled.</summary>
+/// <returns>True if the Stream should be polled with Read.</returns>
+/// <remarks>
+/// The polling interval is FastMS after a poll that received data, and doubles after each idle poll, up to SlowMS.
+/// </remarks>
+bool LineReader::Due()
+{
+	uint32_t t = millis();
+	if (t - LastPoll < PeriodMS)
+		return false;
+	LastPoll = t;
+	if (Received)
+		PeriodMS = FastMS;
+	else if (PeriodMS < SlowMS)
+		PeriodMS = PeriodMS * 2 < SlowMS ? PeriodMS * 2 : SlowMS;
+	return true;
+}
+
+/// <summary>Read the available data from the Stream, passing each complete line to the App's Input.</summary>
+/// <param name="stream">The Stream to read.</param>
+/// <param name="app">The App to process the lines.</param>
+void LineReader::Read(Stream& stream, App* app)
+{
+	int n = stream.available();
+	Received = n > 0;
+	while (n > 0)
+	{
+		if (Length >= LineReaderBytes)
+		{
+			// the line is too long for the buffer, so discard it through its terminator
+			// (counting it only once, however many buffers it fills)
+			Length = 0;
+			if (!Discarding)
+			{
+				Discarding = true;
+				++Overflows;
+				++LinesDropped;
+			}
+		}
+		// read as much as is available and fits in the buffer
+		size_t want = LineReaderBytes - Length;
+		if ((size_t)n < want)
+			want = n;
+		size_t got = stream.readBytes(Line + Length, want);
+		if (got == 0)
+			break;
+		n -= got;
+		char* start = Line;
+		char* scan = Line + Length;
+		char* end = scan + got;
+		char* t;
+		while ((t = FindTerminator(scan, end)) != NULL)
+		{
+			*t = '\0';
+			if (Discarding)
+				Discarding = false;				// the end of the line that was too long
+			else if (t > start)
+			{
+				app->Input(start, t - start);	// pass non-empty lines to the App
+				++LinesRead;
+			}
+			start = scan = t + 1;
+		}
+		// keep the partial line at the start of the buffer
+		Length = end - start;
+		memmove(Line, start, Length);
+	}
+}
+
+/// <summary>Find the first line terminator in a range of characters.</summary>
+/// <param name="p">The start of the range.</param>
+/// <param name="end">The end of the range.</param>
+/// <returns>The first terminator, or NULL if there is none.</returns>
+char* LineReader::FindTerminator(char* p, char* end)
+{
+	// each search need only look ahead of the earliest terminator found so far
+	char* t = end;
+	for (const char* c = ";\n\r"; *c != '\0'; ++c)
+	{
+		char* f = (char*)memchr(p, *c, t - p);
+		if (f != NULL)
+			t = f;
+	}
+	return t == end ? NULL : t;
+}
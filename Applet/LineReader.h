@@ -0,0 +1,70 @@
+/*
+
+   O                      OOO              O
+  OOO                      OO             OO
+ OO OO                     OO             OO
+OO   OO OO OOO  OO OOO     OO    OOOOO  OOOOOO
+OO   OO  OO  OO  OO  OO    OO   OO   OO   OO
+OOOOOOO  OO  OO  OO  OO    OO   OOOOOOO   OO
+OO   OO  OO  OO  OO  OO    OO   OO        OO
+OO   OO  OOOOO   OOOOO     OO   OO   OO   OO OO
+OO   OO  OO      OO       OOOO   OOOOO     OOO
+         OO      OO
+        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _LineReader_h
+#define _LineReader_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <Applet.h>
+
+// the size in bytes of the buffer for assembling an input line
+// (may be defined in the build to allow longer input lines)
+#ifndef LineReaderBytes
+#define LineReaderBytes 64
+#endif
+
+/// <summary>Assembles input lines from a Stream and passes them to an App for processing.</summary>
+/// <remarks>
+/// Lines are terminated by ';' or CR or LF. Characters are read in bulk into a fixed buffer, so no memory
+/// is allocated, and terminators are found with memchr rather than by testing each character.
+/// A line too long for the buffer is discarded, and counted in Overflows.
+/// Due provides adaptive polling for the owner of the Stream: every FastMS while data is arriving,
+/// backing off by doubling to every SlowMS while idle.
+/// </remarks>
+class LineReader
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="fastMS">The polling interval, in milliseconds, while data is arriving.</param>
+	/// <param name="slowMS">The polling interval, in milliseconds, while idle.</param>
+	LineReader(uint32_t fastMS, uint32_t slowMS) : FastMS(fastMS), SlowMS(slowMS), PeriodMS(slowMS) { LastPoll = millis(); }
+
+	bool		Due();
+	void		Read(Stream& stream, App* app);
+
+	uint32_t	Overflows = 0;			// # lines discarded for being too long
+
+private:
+	char*		FindTerminator(char* p, char* end);
+
+	char		Line[LineReaderBytes + 1];	// buffer for assembling a line, with room for a terminating null
+	size_t		Length = 0;				// # characters in the buffer (sized for any LineReaderBytes)
+	bool		Discarding = false;		// true while discarding the rest of a line that was too long
+	uint32_t	FastMS;					// in ms - polling interval while data is arriving
+	uint32_t	SlowMS;					// in ms - polling interval while idle
+	uint32_t	PeriodMS;				// in ms - current polling interval
+	uint32_t	LastPoll;				// in ms - time of the last poll
+	bool		Received = false;		// true if data arrived in the last poll
+};
+
+#endif
@@ -16,111 +16,163 @@ OOOO    OO   OO OOOOOO    OOOO   OOO OO  OOOOO
 
 #include "FMBlue.h"
 
+volatile bool FMBlue::RxPending = false;
+volatile bool FMBlue::Busy = false;
+
+/// <summary>Interrupt handler for the rising SPI_IRQ line, latching that the device has data to be read.</summary>
+void FMBlue::OnIrq()
+{
+	// the device raises the line for the responses to our own transactions, too, which are ignored
+	if (!Busy)
+		RxPending = true;
+}
+
 /// <summary>One-time Setup initialization for the Applet.</summary>
 void FMBlue::Setup()
 {
 	// Init BLE
 //	debug.println("BLE Setup");
 
-	if (!ble.begin(false))	// no VERBOSE mode
+	if (!Link->Begin(ServerName))
 	{
-		debug.println("No BLE");
+		FMLOG_ERROR(FMLOG_CAT_COMM, "No BLE");
 		return;
 	}
 //	debug.println("OK");
 
-	// Disable command echo from Bluefruit
-	ble.echo(false);
-
-	// set the server name
-	ble.println(String("AT+GAPDEVNAME=") + ServerName);
-	if (!ble.waitForOK())
+	// latch the IRQ line to learn when data arrives, rather than polling the device for it
+	IrqPin = Link->IrqPin();
+	int irq = IrqPin >= 0 ? digitalPinToInterrupt(IrqPin) : -1;
+	if (irq >= 0)
 	{
-		debug.println("BLE error setting name");
-		return;
+		UseIrq = true;
+		attachInterrupt(irq, OnIrq, RISING);
+		// the connection state, and data as a fallback, still need to be polled, but only slowly
+		Timer.PeriodMS = 500;
 	}
-
-	ble.verbose(false);  // debug info is a little annoying after this point!
-
-	// Set Bluefruit to DATA mode
-	ble.setMode(BLUEFRUIT_MODE_DATA);
-
-	// set the timeout just a bit longer
-//	debug.println("BLE timeout: ", ble.getTimeout());	// 250
-	ble.setTimeout(500);
 }
 
 /// <summary>Periodically poll activities for the Applet.</summary>
 /// <remarks>
-/// Periodically poll the Bluetooth device for incoming characters terminated by ';' or CR or LF, building an
+/// Read incoming characters from the Bluetooth device, terminated by ';' or CR or LF, building an
 /// Input string to be passed to the Parent App Input method for processing by registered Applets.
+/// Data is read when the IRQ line has signalled it's pending, and polled along with the connection as a fallback,
+/// or else polled every 5 ms while it's arriving, backing off to 100 ms. The connection is checked periodically,
+/// or when an IRQ edge shows data has arrived before it's known.
+/// IRQ edges are ignored while our own transactions with the device are Busy, since each raises the line for its response.
 /// </remarks>
 void FMBlue::Run()
 {
-	// polling the Bluetooth device can be quite costly in processor time,
-	// so we only check periodically using a Metronome Timer
-	if (Timer)
+	// service the transport, which may know cheaply that data is waiting
+	Busy = true;
+	bool waiting = Link->Poll();
+
+	// checking the Bluetooth connection can be quite costly in processor time,
+	// so we only check periodically using a Metronome Timer, or when a data edge shows we've been connected
+	bool tick = Timer;
+	if (tick || (RxPending && !Connected))
 	{
 		// check for connection
-		bool newConnected = ble.isConnected();
+		bool newConnected = Link->Connected();
 		if (newConnected != Connected)
 		{
 			// Connected status has changed!
 			Connected = newConnected;
+			// start the connection with no output pending and fresh stats
+			ChunkLen = 0;
+			TxBytes = 0;
+			TxPackets = 0;
 			if (Connected)
 			{
-				debug.println("BLE connected");
+				fmDebug.Trace(MsgConnected, (const char*)NULL, FMLOG_CAT_COMM);
 			}
 			else
 			{
-				debug.println("BLE disconnected");
+				fmDebug.Trace(MsgDisconnected, (const char*)NULL, FMLOG_CAT_COMM);
 			}
+			// let the App know, to resync the controller with a snapshot of the Applets' state
+			Parent->LinkChanged();
+			Flush();
 		}
+	}
 
-		// nothing to do if we're not connected
-		if (!Connected)
-			return;
+	// nothing to do if we're not connected (and any edge has been answered by the check above)
+	if (!Connected)
+	{
+		RxPending = false;
+		Busy = false;
+		return;
+	}
 
-		// check for new BLE data
-		while (ble.available())
-		{
-			char c = ble.read();
-			if (c == ';' || c == '\n' || c == '\r')
-			{
-				if (Buffer.length() > 0)
-				{
-					// hit terminator with non-empty buffer
-					// pass it to the Parent App who will vector it to the appropriate Applet
-					// (this may eventually come back to us as our own Input)
-					Parent->Input(Buffer);
-					// clear the buffer
-					// Note: this does not reduce the reserve capacity of the String in the current implementation
-					Buffer = "";
-				}
-			}
-			else
-			{
-				// buffer the character and keep looking for terminator
-				// Note: the String capacity will only grow as needed above our initial reserve amount (so maybe never)
-				Buffer.concat(c);
-			}
-		}
+	// send the output packed so far once it's waited long enough for more
+	if (ChunkLen != 0 && micros() - ChunkStart >= CoalesceMicros)
+		Flush();
+
+	// read new BLE data when the transport or the IRQ line has signalled it's pending,
+	// or else poll for it, often while it's arriving and less often when idle
+	// (the IRQ line is raised for any SDEP response, not only for data, and an edge may be missed,
+	// so with the IRQ the data is still polled slowly, along with the connection)
+	if (waiting || (UseIrq ? RxPending || tick : Reader.Due()))
+	{
+		RxPending = false;
+		// pass each complete line to the Parent App who will vector it to the appropriate Applet
+		// (this may eventually come back to us as our own Input)
+		Reader.Read(*Link, Parent);
 	}
+	Busy = false;
+	// the IRQ line stays high while the device has more data, which may have arrived while its edges were ignored
+	if (UseIrq && digitalRead(IrqPin) == HIGH)
+		RxPending = true;
 }
 
 /// <summary>Output the string through the Bluetooth device.</summary>
 /// <param name="s">The string to be output.</param>
 /// <returns>True if connected (and the string write was attempted).</returns>
 bool FMBlue::Write(const String& s)
+{
+	return Pack(s.c_str(), s.length());
+}
+
+/// <summary>Pack bytes into the chunks of output, sending each chunk as it fills.</summary>
+/// <param name="s">The bytes to be output.</param>
+/// <param name="len">The number of bytes.</param>
+/// <returns>True if connected (and the output was attempted).</returns>
+bool FMBlue::Pack(const char* s, size_t len)
 {
 	// avoid if not Connected
 	if (!Connected)
 		return false;
-	// output the string
-	ble.write(s.c_str());
+	while (len != 0)
+	{
+		if (ChunkLen == 0)
+			ChunkStart = micros();
+		size_t n = BlueMTU - ChunkLen;
+		if (n > len)
+			n = len;
+		memcpy(Chunk + ChunkLen, s, n);
+		ChunkLen += n;
+		s += n;
+		len -= n;
+		if (ChunkLen == BlueMTU)
+			Flush();
+	}
 	return true;
 }
 
+/// <summary>Send the output packed so far through the Bluetooth device.</summary>
+void FMBlue::Flush()
+{
+	if (ChunkLen == 0)
+		return;
+	bool busy = Busy;
+	Busy = true;
+	Link->write((const uint8_t*)Chunk, ChunkLen);
+	Busy = busy;
+	TxBytes += ChunkLen;
+	++TxPackets;
+	ChunkLen = 0;
+}
+
 /// <summary>Process a Command string.</summary>
 /// <param name="s">The Command string.</param>
 /// <remarks>
@@ -128,6 +180,8 @@ bool FMBlue::Write(const String& s)
 ///		'i' - Print BLE information to the debug output.
 ///		'd' - Force Bluetooth disconnect (e.g. for testing purposes).
 ///		'r' - Perform a factory reset of the Bluetooth device. (Will surely require a subsequent reset of the Arduino.)
+///		's' - Print the output stats for this connection to the debug output: bytes, packets and average fill.
+///		'c' - Set CoalesceMicros from the decimal value following the command, e.g. "c2000".
 /// </remarks>
 void FMBlue::Command(const String& s)
 {
@@ -135,23 +189,33 @@ void FMBlue::Command(const String& s)
 	{
 	case 'i':
 		// Print BLE information
-		debug.println("BLE info:");
-		ble.info();
+		debug.println(F("BLE info:"));
+		Link->Info();
 		break;
 	case 'd':
 		// Force Bluetooth disconnect
-		ble.disconnect();
+		Link->Disconnect();
 		break;
 	case 'r':
 		// Perform a factory reset to make sure everything is in a known state
-		debug.println("BLE factory reset");
-		if (!ble.factoryReset())
-			debug.println("BLE factory reset error");
+		debug.println(F("BLE factory reset"));
+		if (!Link->FactoryReset())
+			debug.println(F("BLE factory reset error"));
 		else
-			debug.println("BLE reset done");
+			debug.println(F("BLE reset done"));
+		break;
+	case 's':
+		// Print the output stats for this connection
+		debug.print(F("BLE tx bytes:"), TxBytes);
+		debug.print(F(" packets:"), TxPackets);
+		debug.println(F(" fill:"), TxPackets == 0 ? 0.0 : (double)TxBytes / TxPackets);
+		break;
+	case 'c':
+		// Set the coalescing deadline for output
+		CoalesceMicros = strtoul(s.c_str() + 1, NULL, 10);
 		break;
 	default:
-		debug.println("invalid FMBlue input: ", s[0]);
+		FMLOG_WARN(FMLOG_CAT_COMM, "invalid FMBlue input: ", s[0]);
 		break;
 	}
 }
@@ -159,8 +223,11 @@ void FMBlue::Command(const String& s)
 /// <summary>Output a terminated packet string through the Bluetooth device.</summary>
 /// <param name="s">The string to be output.</param>
 /// <returns>True if connected (and the string write was attempted).</returns>
+/// <remarks>
+/// The string is packed with others into BLE packets, so it may be sent split across packets.
+/// </remarks>
 bool FMBlue::Output(const String& s)
 {
 	// add a packet-terminating ';'
-	return Write(s + ";");
+	return Pack(s.c_str(), s.length()) && Pack(";", 1);
 }
@@ -24,40 +24,93 @@ OOOO    OO   OO OOOOOO    OOOO   OOO OO  OOOOO
 #endif
 
 #include <FMDebug.h>
-#include <Adafruit_BLE.h>
-#include <Adafruit_BluefruitLE_SPI.h>
+#include <FMLink.h>
 #include <Metronome.h>
 #include <Applet.h>
+#include <LineReader.h>
+
+// the size in bytes of a BLE packet payload, into which output is packed
+// (may be defined in the build for a device with a larger MTU)
+#ifndef BlueMTU
+#define BlueMTU 20
+#endif
 
 /// <summary>An Adafruit Bluefruit Applet implementation.</summary>
 /// <remarks>
 /// BlueCtrl implements Bluetooth bidirectional communication via strings of clear text
 /// (terminated with ';' or CR or LF) for the Adafruit Bluefruit interfaces.
+/// The device is reached through an FMLink transport, an FMBlueLink on the Arduino, or e.g. an FMHostLink
+/// on a host for measuring the protocol.
+/// Output is packed into chunks of BlueMTU bytes, the payload of a BLE packet, and each chunk is written to the
+/// device in one SPI transaction. A chunk is sent when it's full, when CoalesceMicros has passed since its
+/// first byte was packed, or on Flush. The bytes and packets sent are counted for each connection.
+/// The SPI_IRQ line, raised by the device when it has a response to be read, is latched by a pin interrupt,
+/// so received data is read on the next pass of the loop and the device isn't polled rapidly while idle.
+/// The device raises the line for every SDEP response, not only for received data, so edges during our own
+/// transactions are ignored, a read an edge prompts may still find nothing, and an edge may be missed;
+/// so the connection state, and data as a fallback, are still polled every 500 ms. This use of the IRQ line has yet to be verified on the hardware. If the pin has no
+/// interrupt, data is polled every 5 ms while it's arriving, backing off to 100 ms, and the connection every 100 ms.
+/// Changes in the connection are published with App::LinkChanged, so the App only formats output while it can be sent,
+/// and the snapshot sent by the Applets when the connection is made is flushed in one burst.
 /// </remarks>
 class FMBlue : public Applet
 {
 public:
-	/// <summary>Constructor.</summary>
+#if defined(ARDUINO)
+	/// <summary>Constructor, for an Adafruit Bluefruit SPI device.</summary>
 	/// <param name="prefix">The character code to associate with this Applet.</param>
 	/// <param name="name">The name to assign to this Bluetooth device.</param>
 	/// <param name="cs">The SPI_CS pin for Bluetooth hardware connection.</param>
 	/// <param name="irq">The SPI_IRQ pin for Bluetooth hardware connection.</param>
 	/// <param name="rst">The SPI_RST pin for Bluetooth hardware connection. Set to -1 if unused.</param>
 	FMBlue(char prefix, char* servername, int8_t cs = 8, int8_t irq = 7, int8_t rst = 4) :
-		Applet(prefix), ble(cs, irq, rst), Timer(100), ServerName(servername) { Name = "Bluetooth"; Buffer.reserve(10); }
+		Applet(prefix), ServerName(servername), Timer(100), Reader(5, 100), BlueLink(cs, irq, rst), Link(&BlueLink) { Name = "Bluetooth"; }
+#endif
+
+	/// <summary>Constructor, for a device reached through another transport.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="name">The name to assign to this Bluetooth device.</param>
+	/// <param name="link">The transport to the device.</param>
+	FMBlue(char prefix, char* servername, FMLink* link) :
+		Applet(prefix), ServerName(servername), Timer(100), Reader(5, 100),
+#if defined(ARDUINO)
+		BlueLink(-1, -1, -1),
+#endif
+		Link(link) { Name = "Bluetooth"; }
 
 	void		Setup();
 	void		Run();
 	void		Command(const String& s);
 	bool		Write(const String& s);
 	bool		Output(const String& s);
+	/// <summary>Determine if the Bluetooth link to the controller is up.</summary>
+	bool		LinkUp() { return Connected; }
+	void		Flush();
+
+	uint32_t	CoalesceMicros = 5000;	// in us - longest time output waits to be packed with more before it's sent
+	uint32_t	TxBytes = 0;		// # bytes sent in this connection
+	uint32_t	TxPackets = 0;		// # packets sent in this connection
 
 private:
 	char*		ServerName;			// The name to be assigned to the Bluetooth server
-	Metronome	Timer;				// Timer to be used for polling the Bluetooth interface
-	Adafruit_BluefruitLE_SPI ble;	// The Adafruit Bluefruit device
+	Metronome	Timer;				// Timer to be used for polling the Bluetooth connection
+	LineReader	Reader;				// Reader for assembling input lines from the Bluetooth device
+#if defined(ARDUINO)
+	FMBlueLink	BlueLink;			// The transport to an Adafruit Bluefruit SPI device, if used (its pins only stored until Begin)
+#endif
+	FMLink*		Link;				// The transport to the Bluetooth device
 	bool		Connected = false;	// Record of the last known Connected state for the Bluetooth device
-	String		Buffer;				// Buffer to receive characters from the Bluetooth device
+
+	int8_t		IrqPin = -1;		// The pin raised by the device when it has data to be read (-1 if none)
+	bool		UseIrq = false;		// True if the IrqPin is latched by an interrupt, rather than polling for data
+	static volatile bool RxPending;	// Set by the IrqPin interrupt when the device has data to be read
+	static volatile bool Busy;		// Set while our own transactions with the device, whose responses raise the IrqPin, are running
+	static void	OnIrq();
+
+	bool		Pack(const char* s, size_t len);
+	char		Chunk[BlueMTU];		// The chunk of output being packed
+	uint8_t		ChunkLen = 0;		// # bytes in the Chunk
+	uint32_t	ChunkStart;			// in us - time the first byte was packed into the Chunk
 };
 
 #endif
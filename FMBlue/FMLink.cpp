@@ -0,0 +1,216 @@
+/*
+
+OOOOOOO OO   OO OOOO      OO            OOO
+ OO  OO OOO OOO  OO       OO             OO
+ OO   O OOOOOOO  OO                      OO
+ OO O   OOOOOOO  OO      OOO    OO OOO   OO  OO
+ OOOO   OO O OO  OO       OO     OO  OO  OO OO
+ OO O   OO   OO  OO       OO     OO  OO  OOOO
+ OO     OO   OO  OO   O   OO     OO  OO  OO OO
+ OO     OO   OO  OO  OO   OO     OO  OO  OO  OO
+OOOO    OO   OO OOOOOOO  OOOO    OO  OO OOO  OO
+
+
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMLink.h"
+#if !defined(ARDUINO)
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#if defined(ARDUINO)
+/// <summary>Start the Bluefruit device in DATA mode, advertising a name.</summary>
+/// <param name="name">The name to advertise to the controller.</param>
+/// <returns>True if the device started.</returns>
+bool FMBlueLink::Begin(const char* name)
+{
+	if (!ble.begin(false))	// no VERBOSE mode
+		return false;
+
+	// Disable command echo from Bluefruit
+	ble.echo(false);
+
+	// set the server name
+	ble.println(String("AT+GAPDEVNAME=") + name);
+	if (!ble.waitForOK())
+		return false;
+
+	ble.verbose(false);  // debug info is a little annoying after this point!
+
+	// Set Bluefruit to DATA mode
+	ble.setMode(BLUEFRUIT_MODE_DATA);
+
+	// set the timeout just a bit longer
+//	debug.println("BLE timeout: ", ble.getTimeout());	// 250
+	ble.setTimeout(500);
+	return true;
+}
+#endif
+
+#if !defined(ARDUINO)
+/// <summary>Open a pseudo-terminal for the controller to connect to.</summary>
+/// <returns>True if it opened. The controller opens the slave named by PtyName.</returns>
+bool FMHostLink::OpenPty()
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+		return false;
+	// pass the bytes through untouched
+	struct termios t;
+	tcgetattr(fd, &t);
+	cfmakeraw(&t);
+	tcsetattr(fd, TCSANOW, &t);
+	strncpy(Pty, ptsname(fd), sizeof(Pty) - 1);
+	// the master only reports the slave closed once it's been opened, so open it once to start disconnected
+	close(open(Pty, O_RDWR | O_NOCTTY));
+	Attach(fd);
+	return true;
+}
+
+/// <summary>Use an open file descriptor to reach the controller.</summary>
+/// <param name="fd">The file descriptor.</param>
+void FMHostLink::Attach(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	Fd = fd;
+	Out.Free = In.Free = micros();
+}
+
+/// <summary>Determine if the controller is connected.</summary>
+/// <returns>True if the other end of the pseudo-terminal or socket is open.</returns>
+bool FMHostLink::Connected()
+{
+	if (Fd < 0)
+		return false;
+	struct pollfd p = { Fd, POLLIN, 0 };
+	poll(&p, 1, 0);
+	return (p.revents & (POLLHUP | POLLERR | POLLNVAL)) == 0;
+}
+
+/// <summary>Queue data to be sent in one direction, as packets of MTU bytes.</summary>
+/// <param name="pipe">The direction.</param>
+/// <param name="data">The data.</param>
+/// <param name="size">The number of bytes.</param>
+void FMHostLink::Send(Pipe& pipe, const uint8_t* data, size_t size)
+{
+	uint16_t mtu = MTU == 0 || MTU > HostLinkMaxMTU ? HostLinkMaxMTU : MTU;
+	while (size != 0)
+	{
+		uint16_t len = size < mtu ? size : mtu;
+		// the packet is sent when the link is free, taking its time at the emulated bandwidth
+		uint32_t now = micros();
+		if ((int32_t)(pipe.Free - now) < 0)
+			pipe.Free = now;
+		if (BytesPerSecond != 0)
+			pipe.Free += (uint32_t)((uint64_t)len * 1000000 / BytesPerSecond);
+		++Packets;
+		if (pipe.Count == HostLinkPackets || (LossPercent != 0 && rand() % 100 < LossPercent))
+		{
+			++Lost;
+		}
+		else
+		{
+			Packet& p = pipe.Packets[pipe.Head];
+			p.Due = pipe.Free + LatencyMicros;
+			p.Len = len;
+			memcpy(p.Data, data, len);
+			pipe.Head = (pipe.Head + 1) % HostLinkPackets;
+			++pipe.Count;
+		}
+		data += len;
+		size -= len;
+	}
+}
+
+/// <summary>Get the oldest packet in flight in one direction, if it has arrived.</summary>
+/// <param name="pipe">The direction.</param>
+/// <returns>The packet, removed from the pipe, or NULL if none has arrived.</returns>
+FMHostLink::Packet* FMHostLink::Arrived(Pipe& pipe)
+{
+	if (pipe.Count == 0)
+		return NULL;
+	Packet& p = pipe.Packets[(pipe.Head + HostLinkPackets - pipe.Count) % HostLinkPackets];
+	if ((int32_t)(micros() - p.Due) < 0)
+		return NULL;
+	--pipe.Count;
+	return &p;
+}
+
+/// <summary>Service the link, moving packets along in both directions.</summary>
+/// <returns>True if data from the controller is waiting to be read.</returns>
+bool FMHostLink::Poll()
+{
+	if (Fd < 0)
+		return false;
+	// keep the times the links are free from falling so far behind that they wrap
+	uint32_t now = micros();
+	if ((int32_t)(Out.Free - now) < 0)
+		Out.Free = now;
+	if ((int32_t)(In.Free - now) < 0)
+		In.Free = now;
+	// deliver the packets to the controller that have arrived
+	for (Packet* p; (p = Arrived(Out)) != NULL; )
+		::write(Fd, p->Data, p->Len);
+	// send the data from the controller on its way, a packet at a time, while there's room in flight
+	uint8_t buffer[HostLinkMaxMTU];
+	uint16_t mtu = MTU == 0 || MTU > HostLinkMaxMTU ? HostLinkMaxMTU : MTU;
+	ssize_t n;
+	while (In.Count < HostLinkPackets && (n = ::read(Fd, buffer, mtu)) > 0)
+		Send(In, buffer, n);
+	// and receive the packets from the controller that have arrived, while there's room
+	while (In.Count != 0 && sizeof(Rx) - RxCount >= HostLinkMaxMTU)
+	{
+		Packet* p = Arrived(In);
+		if (p == NULL)
+			break;
+		for (uint16_t i = 0; i < p->Len; ++i)
+			Rx[(RxTail + RxCount++) % sizeof(Rx)] = p->Data[i];
+	}
+	return RxCount != 0;
+}
+
+/// <summary>Get the number of bytes from the controller waiting to be read.</summary>
+int FMHostLink::available()
+{
+	Poll();
+	return RxCount;
+}
+
+/// <summary>Read a byte from the controller.</summary>
+/// <returns>The byte, or -1 if none is waiting.</returns>
+int FMHostLink::read()
+{
+	if (RxCount == 0)
+		return -1;
+	uint8_t c = Rx[RxTail];
+	RxTail = (RxTail + 1) % sizeof(Rx);
+	--RxCount;
+	return c;
+}
+
+/// <summary>Get the next byte from the controller without reading it.</summary>
+/// <returns>The byte, or -1 if none is waiting.</returns>
+int FMHostLink::peek()
+{
+	return RxCount == 0 ? -1 : Rx[RxTail];
+}
+
+/// <summary>Write bytes to the controller, as packets on the emulated link.</summary>
+/// <param name="buffer">The bytes.</param>
+/// <param name="size">The number of bytes.</param>
+/// <returns>The number of bytes written (including any lost).</returns>
+size_t FMHostLink::write(const uint8_t *buffer, size_t size)
+{
+	Send(Out, buffer, size);
+	Poll();
+	return size;
+}
+#endif
@@ -0,0 +1,171 @@
+/*
+
+OOOOOOO OO   OO OOOO      OO            OOO
+ OO  OO OOO OOO  OO       OO             OO
+ OO   O OOOOOOO  OO                      OO
+ OO O   OOOOOOO  OO      OOO    OO OOO   OO  OO
+ OOOO   OO O OO  OO       OO     OO  OO  OO OO
+ OO O   OO   OO  OO       OO     OO  OO  OOOO
+ OO     OO   OO  OO   O   OO     OO  OO  OO OO
+ OO     OO   OO  OO  OO   OO     OO  OO  OO  OO
+OOOO    OO   OO OOOOOOO  OOOO    OO  OO OOO  OO
+
+
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMLink_h
+#define _FMLink_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#if defined(ARDUINO)
+#include <Adafruit_BLE.h>
+#include <Adafruit_BluefruitLE_SPI.h>
+#endif
+
+/// <summary>A byte-stream transport to the controller, carrying the messages of an FMBlue Applet.</summary>
+/// <remarks>
+/// Reads come through the Stream interface, and writes of whole packets through write(buffer, size).
+/// FMBlueLink is the transport for the Adafruit Bluefruit devices, and FMHostLink stands in for it on a host,
+/// for measuring the protocol off the device.
+/// </remarks>
+class FMLink : public Stream
+{
+public:
+	/// <summary>Start the transport.</summary>
+	/// <param name="name">The name to advertise to the controller.</param>
+	/// <returns>True if the transport started.</returns>
+	virtual bool	Begin(const char* name) = 0;
+	/// <summary>Determine if the controller is connected.</summary>
+	/// <remarks>This may be costly, so should be polled sparingly.</remarks>
+	virtual bool	Connected() = 0;
+	/// <summary>Service the transport, once each pass through the loop.</summary>
+	/// <returns>True if data is known to be waiting to be read.</returns>
+	virtual bool	Poll() { return false; }
+	/// <summary>Get the pin raised by the transport when it has data to be read.</summary>
+	/// <returns>The pin, or -1 if none.</returns>
+	virtual int8_t	IrqPin() { return -1; }
+	/// <summary>Force the controller to disconnect.</summary>
+	virtual void	Disconnect() { }
+	/// <summary>Print information about the transport to the debug output.</summary>
+	virtual void	Info() { }
+	/// <summary>Reset the transport to its factory settings.</summary>
+	/// <returns>True if the reset succeeded.</returns>
+	virtual bool	FactoryReset() { return true; }
+
+	using Print::write;
+};
+
+#if defined(ARDUINO)
+/// <summary>The FMLink transport for the Adafruit Bluefruit SPI devices.</summary>
+class FMBlueLink : public FMLink
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="cs">The SPI_CS pin for Bluetooth hardware connection.</param>
+	/// <param name="irq">The SPI_IRQ pin for Bluetooth hardware connection.</param>
+	/// <param name="rst">The SPI_RST pin for Bluetooth hardware connection. Set to -1 if unused.</param>
+	FMBlueLink(int8_t cs, int8_t irq, int8_t rst) : ble(cs, irq, rst), Irq(irq) { }
+
+	bool		Begin(const char* name);
+	bool		Connected() { return ble.isConnected(); }
+	int8_t		IrqPin() { return Irq; }
+	void		Disconnect() { ble.disconnect(); }
+	void		Info() { ble.info(); }
+	bool		FactoryReset() { return ble.factoryReset(); }
+
+	int			available() { return ble.available(); }
+	int			read() { return ble.read(); }
+	int			peek() { return ble.peek(); }
+	size_t		write(uint8_t c) { return ble.write(c); }
+	size_t		write(const uint8_t *buffer, size_t size) { return ble.write(buffer, size); }
+
+private:
+	Adafruit_BluefruitLE_SPI ble;	// The Adafruit Bluefruit device
+	int8_t		Irq;				// The SPI_IRQ pin
+};
+#endif
+
+#if !defined(ARDUINO)
+// the largest packet FMHostLink can emulate
+#ifndef HostLinkMaxMTU
+#define HostLinkMaxMTU 244
+#endif
+
+// the # packets FMHostLink can hold in flight in each direction
+#ifndef HostLinkPackets
+#define HostLinkPackets 64
+#endif
+
+/// <summary>An FMLink transport over a pseudo-terminal or socket on a host, emulating a BLE link.</summary>
+/// <remarks>
+/// The controller end is the slave of a pseudo-terminal opened with OpenPty, e.g. for extras/LinkLoad.py,
+/// or the other end of a socketpair passed to Attach.
+/// Each write, and each read from the controller, is split into packets of MTU bytes, and each packet
+/// is delayed for its transmission at BytesPerSecond, plus LatencyMicros, and is lost with a probability of
+/// LossPercent. Each direction is emulated separately. Poll moves the packets along, so it must be called often.
+/// </remarks>
+class FMHostLink : public FMLink
+{
+public:
+	bool		OpenPty();
+	/// <summary>Get the path of the slave of the pseudo-terminal, for the controller to open.</summary>
+	const char*	PtyName() { return Pty; }
+	/// <summary>Use an open file descriptor, e.g. one end of a socketpair, to reach the controller.</summary>
+	/// <param name="fd">The file descriptor.</param>
+	void		Attach(int fd);
+
+	bool		Begin(const char*) { return Fd >= 0; }
+	bool		Connected();
+	bool		Poll();
+
+	int			available();
+	int			read();
+	int			peek();
+	size_t		write(uint8_t c) { return write(&c, 1); }
+	size_t		write(const uint8_t *buffer, size_t size);
+
+	uint32_t	BytesPerSecond = 0;	// the emulated bandwidth in each direction (0 for unlimited)
+	uint16_t	MTU = 20;			// the emulated packet payload, up to HostLinkMaxMTU
+	uint32_t	LatencyMicros = 0;	// in us - the emulated one-way latency of each packet
+	uint8_t		LossPercent = 0;	// the percentage of packets lost
+	uint32_t	Packets = 0;		// # packets sent in both directions
+	uint32_t	Lost = 0;			// # packets lost, or dropped with no room in flight
+
+private:
+	/// <summary>A packet in flight in one direction.</summary>
+	struct Packet
+	{
+		uint32_t	Due;			// in us - time the packet arrives
+		uint16_t	Len;			// # bytes in the packet
+		uint8_t		Data[HostLinkMaxMTU];
+	};
+	/// <summary>The emulated link in one direction.</summary>
+	struct Pipe
+	{
+		Packet		Packets[HostLinkPackets];	// the packets in flight
+		uint8_t		Head = 0;		// the index of the next packet to be sent
+		uint8_t		Count = 0;		// # packets in flight
+		uint32_t	Free = 0;		// in us - time the link is free to send the next packet
+	};
+	void		Send(Pipe& pipe, const uint8_t* data, size_t size);
+	Packet*		Arrived(Pipe& pipe);
+
+	int			Fd = -1;			// the file descriptor reaching the controller
+	char		Pty[64] = "";		// the path of the pseudo-terminal slave
+	Pipe		Out;				// packets to the controller
+	Pipe		In;					// packets from the controller
+	uint8_t		Rx[1024];			// bytes arrived from the controller, to be read
+	uint16_t	RxTail = 0;			// the index of the next byte to be read
+	uint16_t	RxCount = 0;		// # bytes to be read
+};
+#endif
+
+#endif
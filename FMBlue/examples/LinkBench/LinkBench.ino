@@ -0,0 +1,131 @@
+/*
+
+OOOO      OO            OOO     OOOOOO                          OOO
+ OO       OO             OO      OO  OO                          OO
+ OO                      OO      OO  OO                          OO
+ OO      OOO    OO OOO   OO  OO  OO  OO  OOOOO  OO OOO   OOOOO   OO OO
+ OO       OO     OO  OO  OO OO   OOOOO  OO   OO  OO  OO OO   OO  OOO OO
+ OO       OO     OO  OO  OOOO    OO  OO OOOOOOO  OO  OO OO       OO  OO
+ OO   O   OO     OO  OO  OO OO   OO  OO OO       OO  OO OO       OO  OO
+ OO  OO   OO     OO  OO  OO  OO  OO  OO OO   OO  OO  OO OO   OO  OO  OO
+OOOOOOO  OOOO    OO  OO OOO  OO OOOOOO   OOOOO   OO  OO  OOOOO  OOO  OO
+
+
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+/*
+Bench for the FMBlue link protocol on a Linux host, with FMHostLink standing in for the Bluefruit device.
+The link is served on a pseudo-terminal, whose path is printed on the debug output, emulating the bandwidth,
+packet size, latency and loss of a BLE link. Drive it with extras/LinkLoad.py, e.g.
+	python3 LinkLoad.py /dev/pts/3 --count 2000 --rate 50
+The Bench Applet answers each query of its properties, and each set, with the value through SendProp,
+so every request gets exactly one reply and the round trip runs through App::Input, SendProp and FMBlue.
+This must be built against a host Arduino core, as FMHostLink exists only off the device.
+*/
+
+#include <FMDebug.h>
+#include <FMBlue.h>
+
+// the emulated link: about what a Bluefruit SPI device manages with a phone
+// (each can be overridden at build time, e.g. -DBenchLossPercent=5)
+#ifndef BenchBytesPerSecond
+#define BenchBytesPerSecond 2000
+#endif
+#ifndef BenchMTU
+#define BenchMTU 20
+#endif
+#ifndef BenchLatencyMicros
+#define BenchLatencyMicros 15000
+#endif
+#ifndef BenchLossPercent
+#define BenchLossPercent 0
+#endif
+
+/// <summary>An Applet with a few properties, echoing each one set.</summary>
+class Bench : public Applet
+{
+public:
+	enum Properties
+	{
+		Prop_A = 'a',
+		Prop_B = 'b',
+		Prop_C = 'c',
+	};
+
+	Bench() : Applet('z') { Name = "Bench"; }
+
+	void		Setup() { }
+	void		Run() { }
+	const char*	SnapshotProps() { return "abc"; }
+
+	String		GetProp(char prop)
+	{
+		switch (prop)
+		{
+		case Prop_A:
+			return String(A);
+		case Prop_B:
+			return String(B);
+		case Prop_C:
+			return String(C);
+		}
+		return (String)NULL;
+	}
+
+	bool		SetProp(char prop, const String& v)
+	{
+		switch (prop)
+		{
+		case Prop_A:
+			A = v.toInt();
+			break;
+		case Prop_B:
+			B = v.toInt();
+			break;
+		case Prop_C:
+			C = v.toInt();
+			break;
+		default:
+			return false;
+		}
+		// confirm the new value, as the reply the load generator times
+		SendProp(prop);
+		return true;
+	}
+
+	int32_t		A = 0;
+	int32_t		B = 0;
+	int32_t		C = 0;
+};
+
+App			app;
+FMHostLink	hostLink;
+FMBlue		fmBlue('b', "LinkBench", &hostLink);
+Bench		bench;
+
+void setup()
+{
+	fmDebug.Init("Link Bench", true);
+	app.AddApplet(&fmDebug);
+	hostLink.BytesPerSecond = BenchBytesPerSecond;
+	hostLink.MTU = BenchMTU;
+	hostLink.LatencyMicros = BenchLatencyMicros;
+	hostLink.LossPercent = BenchLossPercent;
+	if (!hostLink.OpenPty())
+	{
+		debug.println(F("No pty"));
+		return;
+	}
+	debug.println(F("Link: "), hostLink.PtyName());
+	app.AddApplet(&fmBlue);
+	app.OutputApplet = &fmBlue;
+	app.AddApplet(&bench);
+}
+
+void loop()
+{
+	app.Run();
+}
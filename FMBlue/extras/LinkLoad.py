@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+#
+# LinkLoad - drive an FMBlue link with a mix of commands and measure the round trips
+#
+#	(c) 2018 Scott Ferguson
+#	This code is licensed under MIT license (see LICENSE file for details)
+#
+# Run the LinkBench example on a Linux host, which prints the pseudo-terminal its link is served on, then:
+#	LinkLoad.py /dev/pts/3 --count 2000 --rate 50 --mix q=3,s=1
+# Each request is a query of a property, e.g. "z?a;", or a set of one, e.g. "z=a42;", sent in the given mix
+# at the given rate with up to --outstanding requests unanswered. Each reply, "z=a42", is matched to the oldest
+# request unanswered for that property, and the latency percentiles, throughput and timeouts are reported.
+# The Applet must answer every query and every set with the property's value, as the LinkBench Bench Applet does.
+# On a lossy link, a reply matched after a lost one is timed from the lost request, until that times out,
+# so keep --timeout near the longest round trip expected.
+
+import argparse
+import os
+import random
+import select
+import sys
+import termios
+import time
+import tty
+
+def parse_mix(text):
+	"""Parse the mix of request kinds, e.g. "q=3,s=1", into a list to choose from."""
+	mix = []
+	for part in text.split(','):
+		kind, _, weight = part.partition('=')
+		if kind not in ('q', 's'):
+			raise argparse.ArgumentTypeError('unknown request kind: ' + kind)
+		mix += [kind] * int(weight or 1)
+	return mix
+
+def percentile(values, p):
+	"""Get the p'th percentile of the sorted values."""
+	if not values:
+		return 0.0
+	return values[min(len(values) - 1, int(p / 100.0 * len(values)))]
+
+class Load:
+	"""The requests in flight on the link, and their results."""
+
+	def __init__(self, fd, args):
+		self.fd = fd
+		self.args = args
+		self.pending = {}		# the send times of the requests unanswered, oldest first, by property
+		self.outstanding = 0
+		self.latencies = []
+		self.timeouts = 0
+		self.unmatched = 0
+		self.sent_bytes = 0
+		self.recv_bytes = 0
+		self.rx = b''
+
+	def send(self, kind, prop):
+		"""Send a request for a property."""
+		if kind == 'q':
+			cmd = '%s?%s;' % (self.args.prefix, prop)
+		else:
+			cmd = '%s=%s%d;' % (self.args.prefix, prop, random.randint(-99999, 99999))
+		data = cmd.encode('ascii')
+		os.write(self.fd, data)
+		self.sent_bytes += len(data)
+		self.pending.setdefault(prop, []).append(time.monotonic())
+		self.outstanding += 1
+
+	def receive(self, wait):
+		"""Read the replies that arrive within wait seconds, matching each to its request."""
+		ready, _, _ = select.select([self.fd], [], [], max(0.0, wait))
+		if ready:
+			try:
+				data = os.read(self.fd, 4096)
+			except OSError:
+				data = b''
+			if not data:
+				sys.exit('link closed')
+			now = time.monotonic()
+			self.recv_bytes += len(data)
+			self.rx += data
+			*replies, self.rx = self.rx.split(b';')
+			for reply in replies:
+				self.match(reply.decode('ascii', 'replace').strip(), now)
+		self.expire()
+
+	def match(self, reply, now):
+		"""Match a reply to the oldest request unanswered for its property."""
+		if len(reply) < 3 or reply[0] != self.args.prefix or reply[1] != '=':
+			return
+		queue = self.pending.get(reply[2])
+		if not queue:
+			self.unmatched += 1
+			return
+		self.latencies.append(now - queue.pop(0))
+		self.outstanding -= 1
+
+	def expire(self):
+		"""Give up on the requests unanswered for longer than the timeout."""
+		limit = time.monotonic() - self.args.timeout
+		for queue in self.pending.values():
+			while queue and queue[0] < limit:
+				queue.pop(0)
+				self.outstanding -= 1
+				self.timeouts += 1
+
+def open_link(path):
+	"""Open the pseudo-terminal of the link, passing the bytes through untouched."""
+	fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+	tty.setraw(fd, termios.TCSANOW)
+	return fd
+
+def main():
+	parser = argparse.ArgumentParser(description='Drive an FMBlue link with a mix of commands and measure the round trips.')
+	parser.add_argument('path', help='the pseudo-terminal of the link')
+	parser.add_argument('--count', type=int, default=1000, help='# requests to send')
+	parser.add_argument('--rate', type=float, default=20, help='requests per second')
+	parser.add_argument('--outstanding', type=int, default=8, help='most requests unanswered at once')
+	parser.add_argument('--mix', type=parse_mix, default=parse_mix('q=3,s=1'), help='weights of queries (q) and sets (s), e.g. q=3,s=1')
+	parser.add_argument('--prefix', default='z', help='the prefix of the Applet to drive')
+	parser.add_argument('--props', default='abc', help='the properties to query and set')
+	parser.add_argument('--timeout', type=float, default=2.0, help='seconds to wait for a reply')
+	parser.add_argument('--settle', type=float, default=1.0, help='seconds to let the link connect and resync first')
+	args = parser.parse_args()
+
+	fd = open_link(args.path)
+	load = Load(fd, args)
+	# let the device notice the connection and send its snapshot, which isn't timed
+	end = time.monotonic() + args.settle
+	while time.monotonic() < end:
+		load.receive(end - time.monotonic())
+	load.rx = b''
+	load.recv_bytes = 0
+	load.unmatched = 0
+
+	start = time.monotonic()
+	due = start
+	sent = 0
+	while sent < args.count or load.outstanding > 0:
+		now = time.monotonic()
+		if sent < args.count and now >= due and load.outstanding < args.outstanding:
+			load.send(random.choice(args.mix), random.choice(args.props))
+			sent += 1
+			due += 1.0 / args.rate
+			continue
+		wait = due - now if sent < args.count and load.outstanding < args.outstanding else args.timeout
+		load.receive(min(wait, 0.1))
+	elapsed = time.monotonic() - start
+	os.close(fd)
+
+	lat = sorted(l * 1000.0 for l in load.latencies)
+	print('requests: %d  replies: %d  timeouts: %d  unmatched: %d' % (sent, len(lat), load.timeouts, load.unmatched))
+	print('elapsed: %.2f s  replies/s: %.1f  bytes sent: %d  received: %d' % (elapsed, len(lat) / elapsed, load.sent_bytes, load.recv_bytes))
+	if lat:
+		print('latency ms  min: %.1f  p50: %.1f  p90: %.1f  p99: %.1f  max: %.1f' %
+			(lat[0], percentile(lat, 50), percentile(lat, 90), percentile(lat, 99), lat[-1]))
+
+if __name__ == '__main__':
+	main()
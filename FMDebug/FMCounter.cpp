@@ -0,0 +1,68 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMCounter.h"
+
+FMCounter* FMCounter::First = NULL;
+
+/// <summary>Constructor, adding the counter to the registry.</summary>
+/// <param name="name">The short name of the counter, which must be a constant string.</param>
+/// <param name="gauge">True for a gauge, recording a value rather than counting events.</param>
+FMCounter::FMCounter(const char* name, bool gauge) : Name(name), Gauge(gauge)
+{
+	Next = First;
+	First = this;
+}
+
+/// <summary>Get the value of the counter.</summary>
+/// <returns>The value, read consistently even if it's being updated from an interrupt handler.</returns>
+uint32_t FMCounter::Value()
+{
+#if defined(__AVR__)
+	// a 32-bit read isn't atomic on AVR
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t v = Count;
+	SREG = sreg;
+	return v;
+#else
+	return Count;
+#endif
+}
+
+/// <summary>Find a counter by name.</summary>
+/// <param name="name">The name of the counter.</param>
+/// <returns>The counter, or NULL if there is none with that name.</returns>
+FMCounter* FMCounter::Find(const char* name)
+{
+	for (FMCounter* c = First; c != NULL; c = c->Next)
+	{
+		if (strcmp(c->Name, name) == 0)
+			return c;
+	}
+	return NULL;
+}
+
+/// <summary>Get the value of a counter by name.</summary>
+/// <param name="name">The name of the counter.</param>
+/// <returns>The value, or zero if there is no counter with that name.</returns>
+uint32_t FMCounter::Get(const char* name)
+{
+	FMCounter* c = Find(name);
+	return c == NULL ? 0 : c->Value();
+}
@@ -0,0 +1,98 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMCounter_h
+#define _FMCounter_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+/// <summary>A named event counter or gauge, registered for reporting through FMDebug.</summary>
+/// <remarks>
+/// Counters are declared statically, e.g. at file scope in the library that counts the events:
+///		FMCounter LimitHits("lim");
+/// and register themselves as they're constructed, so the registry needs no memory beyond the counters.
+/// A counter accumulates with Add or ++, and a gauge records the latest value with Set.
+/// Updates are safe from interrupt handlers and cost only a few instructions.
+/// The 'k' command of FMDebug prints a snapshot of all counters, and the 'K' command toggles a report
+/// of the changes to the counters, streamed to the output Applet once per second.
+/// Counters can be found by name with Find or Get, e.g. for assertions in a benchmark harness.
+/// </remarks>
+class FMCounter
+{
+public:
+	FMCounter(const char* name, bool gauge = false);
+
+	/// <summary>Add to the counter.</summary>
+	/// <param name="n">The amount to add.</param>
+	void		Add(uint32_t n = 1)
+	{
+#if defined(__AVR__)
+		uint8_t sreg = SREG;
+		cli();
+		Count += n;
+		SREG = sreg;
+#elif defined(__arm__)
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		Count += n;
+		__set_PRIMASK(primask);
+#else
+		__atomic_fetch_add(&Count, n, __ATOMIC_RELAXED);
+#endif
+	}
+	/// <summary>Increment the counter.</summary>
+	void		operator++() { Add(); }
+	/// <summary>Set the value of a gauge (or reset a counter).</summary>
+	/// <param name="v">The value.</param>
+	void		Set(uint32_t v)
+	{
+#if defined(__AVR__)
+		uint8_t sreg = SREG;
+		cli();
+		Count = v;
+		SREG = sreg;
+#elif defined(__arm__)
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		Count = v;
+		__set_PRIMASK(primask);
+#else
+		__atomic_store_n(&Count, v, __ATOMIC_RELAXED);
+#endif
+	}
+	uint32_t	Value();
+
+	static FMCounter* Find(const char* name);
+	static uint32_t	Get(const char* name);
+
+	const char*	Name;				// the short name of the counter
+	bool		Gauge;				// true for a gauge, recording a value rather than counting events
+	uint32_t	Reported = 0;		// the value in the last report of changes
+	FMCounter*	Next;				// the next counter in the registry
+
+	static FMCounter* First;		// the first counter in the registry
+
+private:
+	volatile uint32_t Count = 0;	// the count or value
+};
+
+#endif
@@ -25,88 +25,447 @@ FMDebug	fmDebug;
 // The SINGLE instance of Debug for global use
 Debug	debug;
 
+// the text of the Trace messages, in program memory
+#define FMMESSAGE_TEXT(id, text) static const char id##Text[] PROGMEM = text;
+FMMESSAGES(FMMESSAGE_TEXT)
+#undef FMMESSAGE_TEXT
+
+// the table of the Trace message text, indexed by id, in program memory
+static const char* const FMMessageTable[] PROGMEM =
+{
+#define FMMESSAGE_ENTRY(id, text) id##Text,
+	FMMESSAGES(FMMESSAGE_ENTRY)
+#undef FMMESSAGE_ENTRY
+};
+
+/// <summary>Get the text of a Trace message.</summary>
+/// <param name="id">The id of the message.</param>
+/// <returns>The text, in program memory, or NULL if the id is invalid.</returns>
+const __FlashStringHelper* FMMessageText(FMMessage id)
+{
+	if (id >= FMMessageCount)
+		return NULL;
+	return (const __FlashStringHelper*)pgm_read_ptr(&FMMessageTable[id]);
+}
+
 /// <summary>A time-stamped entry for logging event messages.</summary>
+/// <remarks>
+/// In the arena, each entry is immediately followed by its raw argument bytes,
+/// with a terminating null for text. The entry is only formatted for output as needed.
+/// </remarks>
 struct TRACE
 {
 	int64_t		ms;		// ms timestamp for trace event
-	const char	*msg;	// static main message/label for event
-	char		*more;	// additional dynamic (malloc'd) text info for event
+	FMMessage	id;		// id of the main message/label for event
+	uint8_t		cat;	// category of the event
+	char		type;	// FMDebug::TraceArg type of the argument bytes
+	uint8_t		len;	// length of the argument bytes
 };
 
-#define TraceCount 60
+// the size in bytes of the arena holding the Trace log
+// (may be defined in the build to trade memory for history)
+#ifndef TraceBytes
+#define TraceBytes 768
+#endif
+
+// the most bytes of Trace entries written to the TraceStore in each Run
+// (an EEPROM takes milliseconds to write each byte, and the TraceStore also waits for it to be ready between Runs)
+#ifndef TraceSaveBytes
+#define TraceSaveBytes 4
+#endif
 
-uint TraceHead = 0;			// the head of the log entries in the Traces array
-uint TraceTail = 0;			// the tail of the log entries in the Traces array
-TRACE Traces[TraceCount];	// a circular buffer to hold TRACE log entries
+uint8_t TraceArena[TraceBytes];	// a circular arena to hold variable-length TRACE log entries
+uint TraceHead = 0;				// the offset in the arena for the next log entry
+uint TraceTail = 0;				// the offset in the arena of the oldest log entry
+uint TraceWrap = TraceBytes;	// the offset in the arena where entries end before wrapping to the start
+uint TraceEntries = 0;			// # log entries in the arena
+uint TraceUnsaved = 0;			// # newest log entries not yet saved to the TraceStore
+
+/// <summary>Get the size in the arena of a TRACE log entry.</summary>
+/// <param name="len">The length of the argument bytes for the entry.</param>
+/// <returns>The size, rounded up so that the next entry is properly aligned.</returns>
+static uint TraceSize(uint len)
+{
+	const uint align = alignof(TRACE);
+	return (sizeof(TRACE) + len + 1 + align - 1) / align * align;
+}
+
+/// <summary>Get a TRACE log entry in the arena.</summary>
+/// <param name="offset">The offset of the entry in the arena.</param>
+/// <returns>The entry.</returns>
+static TRACE* TraceAt(uint offset)
+{
+	return (TRACE*)(TraceArena + offset);
+}
+
+/// <summary>Get the offset in the arena of the next TRACE log entry.</summary>
+/// <param name="offset">The offset of an entry in the arena.</param>
+/// <returns>The offset of the entry following it.</returns>
+static uint TraceNext(uint offset)
+{
+	offset += TraceSize(TraceAt(offset)->len);
+	return offset >= TraceWrap ? 0 : offset;
+}
+
+/// <summary>Make room for a new TRACE log entry at the head of the arena.</summary>
+/// <param name="len">The length of the argument bytes for the entry.</param>
+/// <returns>The new entry, with its length set, to be filled in by the caller.</returns>
+/// <remarks>
+/// The oldest entries are discarded whole to make room, and an entry never straddles the end of the arena.
+/// </remarks>
+static TRACE* TraceAdd(uint len)
+{
+	uint size = TraceSize(len);
+	// find room for the entry, which must not straddle the end of the arena
+	while (true)
+	{
+		if (TraceEntries == 0)
+		{
+			// the arena is empty, so start at the beginning
+			TraceHead = TraceTail = 0;
+			TraceWrap = TraceBytes;
+			break;
+		}
+		if (TraceHead > TraceTail)
+		{
+			// the free space is at the end of the arena, and then before the tail
+			if (TraceHead + size <= TraceBytes)
+				break;
+			// not enough room at the end, so mark where the entries end and wrap to the start
+			TraceWrap = TraceHead;
+			TraceHead = 0;
+			continue;
+		}
+		// the free space is between the head and the tail
+		if (TraceHead + size <= TraceTail)
+			break;
+		// not enough room, so discard the oldest entry
+		TraceTail = TraceNext(TraceTail);
+		if (TraceTail == 0)
+		{
+			// the tail wrapped to the start, so the entries no longer end before the end of the arena
+			TraceWrap = TraceBytes;
+		}
+		--TraceEntries;
+		if (TraceUnsaved > TraceEntries)
+			TraceUnsaved = TraceEntries;
+	}
+	TRACE* t = TraceAt(TraceHead);
+	t->len = len;
+	// advance the head through the arena
+	TraceHead += size;
+	++TraceEntries;
+	return t;
+}
 
 /// <summary>Creates a string, suitable for output, of a TRACE log entry.</summary>
-/// <param name="inx">The zero-based index of the desired log entry, oldest first. Must be known as valid.</param>
+/// <param name="offset">The offset in the arena of the desired log entry. Must be known as valid.</param>
 /// <returns>The log entry string.</returns>
 /// <remarks>
 /// For internal use only.
 /// </remarks>
-String FMDebug::TraceString(uint inx)
+String FMDebug::TraceString(uint offset)
 {
+	TRACE* t = TraceAt(offset);
 	// format the timestamp and base message
-	String s = "[" + FMDateTime(Traces[inx].ms).ToString() + "] " + Traces[inx].msg;
-	// add the additional string info, if present
-	if (Traces[inx].more)
-		s += Traces[inx].more;
+	String s = "[" + FMDateTime(t->ms).ToString() + "] ";
+	s += FMMessageText(t->id);
+	// add the argument, if present
+	const uint8_t* args = (const uint8_t*)(t + 1);
+	switch (t->type)
+	{
+	case TraceText:
+		s += (const char*)args;
+		break;
+	case TraceLong:
+		{
+			int32_t v;
+			memcpy(&v, args, sizeof(v));
+			s += String((long)v);
+		}
+		break;
+	case TraceULong:
+		{
+			uint32_t v;
+			memcpy(&v, args, sizeof(v));
+			s += String((unsigned long)v);
+		}
+		break;
+	case TraceFloat:
+		{
+			float v;
+			memcpy(&v, args, sizeof(v));
+			s += String(v, 3);
+		}
+		break;
+	case TraceApplet:
+		{
+			uint32_t v[2];
+			memcpy(v, args + 1, sizeof(v));
+			s += (char)args[0];
+			s += " " + String((unsigned long)v[0]) + "/" + String((unsigned long)v[1]);
+		}
+		break;
+	default:
+		break;
+	}
 	return s;
 }
 
 /// <summary>Output a TRACE message and log it.</summary>
-/// <param name="msg">A constant string message.</param>
-/// <param name="more">An additional optional string parameter which must be copied to dynamically allocated memory.</param>
-void FMDebug::Trace(const char* msg, const char* more)
+/// <param name="id">The id of the message.</param>
+/// <param name="more">An additional optional string parameter to be copied into the log.</param>
+/// <param name="cat">The category of the event, 0-7, used to select it for output with TraceEcho.</param>
+void FMDebug::Trace(FMMessage id, const char* more, uint8_t cat)
+{
+	if (more == NULL)
+		Log(id, cat, TraceNone, NULL, 0);
+	else
+		Log(id, cat, TraceText, more, strlen(more));
+}
+
+/// <summary>Output a TRACE message with an integer argument and log it.</summary>
+/// <param name="id">The id of the message.</param>
+/// <param name="v">The argument value.</param>
+/// <param name="cat">The category of the event, 0-7, used to select it for output with TraceEcho.</param>
+void FMDebug::Trace(FMMessage id, long v, uint8_t cat)
+{
+	int32_t a = v;
+	Log(id, cat, TraceLong, &a, sizeof(a));
+}
+
+/// <summary>Output a TRACE message with an unsigned integer argument and log it.</summary>
+/// <param name="id">The id of the message.</param>
+/// <param name="v">The argument value.</param>
+/// <param name="cat">The category of the event, 0-7, used to select it for output with TraceEcho.</param>
+void FMDebug::Trace(FMMessage id, unsigned long v, uint8_t cat)
+{
+	uint32_t a = v;
+	Log(id, cat, TraceULong, &a, sizeof(a));
+}
+
+/// <summary>Output a TRACE message with a floating point argument and log it.</summary>
+/// <param name="id">The id of the message.</param>
+/// <param name="v">The argument value.</param>
+/// <param name="cat">The category of the event, 0-7, used to select it for output with TraceEcho.</param>
+void FMDebug::Trace(FMMessage id, double v, uint8_t cat)
+{
+	float a = v;
+	Log(id, cat, TraceFloat, &a, sizeof(a));
+}
+
+/// <summary>Output a TRACE message that's not in the FMMessages table and log it.</summary>
+/// <param name="msg">A string message.</param>
+/// <param name="more">An additional optional string parameter.</param>
+/// <param name="cat">The category of the event, 0-7, used to select it for output with TraceEcho.</param>
+/// <remarks>The message and additional string are both copied into the log, as the text of a MsgText entry.</remarks>
+void FMDebug::Trace(const char* msg, const char* more, uint8_t cat)
+{
+	if (more == NULL)
+		Log(MsgText, cat, TraceText, NULL, 0, msg);
+	else
+		Log(MsgText, cat, TraceText, more, strlen(more), msg);
+}
+
+/// <summary>Log a TRACE entry, and output it if its category is selected by TraceEcho.</summary>
+/// <param name="id">The id of the message.</param>
+/// <param name="cat">The category of the event, 0-7.</param>
+/// <param name="type">The TraceArg type of the argument bytes.</param>
+/// <param name="args">The argument bytes to be copied into the log.</param>
+/// <param name="len">The length of the argument bytes.</param>
+/// <param name="text">Optional text to be copied into the log ahead of the argument bytes.</param>
+/// <remarks>
+/// Entries are logged as binary records in a fixed arena, so no memory is allocated and nothing is formatted
+/// unless the entry is output. The oldest entries are discarded whole to make room, and the argument bytes
+/// are truncated if they're very long. The entry is only copied to the TraceStore later, by Run.
+/// </remarks>
+void FMDebug::Log(FMMessage id, uint8_t cat, char type, const void* args, uint len, const char* text)
 {
-	// free up any alloc'd memory from a previous use of this TRACE entry in the circular buffer
-	if (Traces[TraceHead].more)
-		free(Traces[TraceHead].more);
+	// limit the arguments to what a single entry can hold
+	uint limit = TraceBytes - sizeof(TRACE) - alignof(TRACE);
+	if (limit > 255)
+		limit = 255;
+	uint pre = text != NULL ? strlen(text) : 0;
+	if (pre > limit)
+		pre = limit;
+	if (pre + len > limit)
+		len = limit - pre;
+	TRACE* t = TraceAdd(pre + len);
 	// record the timestamp
-	Traces[TraceHead].ms = FMDateTime::NowMillis();
+	t->ms = FMDateTime::NowMillis();
 	// and the main message
-	Traces[TraceHead].msg = msg;
-	if (more)
-	{
-		// allocate, copy and record the optional extended message
-		char* m = (char*)malloc(strlen(more) + 1);
-		strcpy(m, more);
-		Traces[TraceHead].more = m;
-	}
-	else
+	t->id = id;
+	t->cat = cat & 7;
+	// and copy the argument bytes
+	t->type = type;
+	uint8_t* a = (uint8_t*)(t + 1);
+	if (pre != 0)
+		memcpy(a, text, pre);
+	if (len != 0)
+		memcpy(a + pre, args, len);
+	a[pre + len] = 0;
+	++TraceUnsaved;
+	// output the TRACE message, if selected
+	if (TraceEcho & (1 << t->cat))
+		debug.println(TraceString((uint8_t*)t - TraceArena));
+}
+
+// the length of a TRACE log entry saved in the TraceStore, without its argument bytes:
+// the timestamp (8 bytes), the message id (1), the category (1), the argument type (1) and the argument length (1)
+static const uint TraceRecordBytes = 12;
+
+/// <summary>Recover the Trace log entries saved in the TraceStore before a reset.</summary>
+/// <remarks>
+/// The entries are added to the log as already saved, and followed by a MsgRestart entry
+/// with the # entries recovered.
+/// </remarks>
+void FMDebug::RecoverTrace()
+{
+	uint8_t record[FMTraceStore::RecordLimit];
+	long count = 0;
+	TraceStore->Open();
+	TraceStore->Rewind();
+	while (true)
 	{
-		// no extended message, so clear it
-		Traces[TraceHead].more = NULL;
+		uint n = TraceStore->Read(record, sizeof(record));
+		if (n == 0)
+			break;
+		if (n < TraceRecordBytes || n > sizeof(record) || record[11] != n - TraceRecordBytes)
+			continue;
+		TRACE* t = TraceAdd(n - TraceRecordBytes);
+		memcpy(&t->ms, record, sizeof(t->ms));
+		t->id = record[8] < FMMessageCount ? (FMMessage)record[8] : MsgText;
+		t->cat = record[9] & 7;
+		t->type = record[10];
+		uint8_t* a = (uint8_t*)(t + 1);
+		memcpy(a, record + TraceRecordBytes, t->len);
+		a[t->len] = 0;
+		++count;
 	}
-	// output the TRACE message
-	debug.println(TraceString(TraceHead));
-	// advance the head through the circular buffer
-	if (++TraceHead >= TraceCount)
-		TraceHead = 0;
-	if (TraceHead == TraceTail)
+	TraceUnsaved = 0;
+	Trace(MsgRestart, count);
+}
+
+/// <summary>Save the Trace log entries not yet saved to the TraceStore.</summary>
+/// <param name="all">True to save all the entries, or false to stop when the current page of the store is full.</param>
+/// <remarks>
+/// The argument bytes of an entry are truncated if the entry won't fit in a page of the store.
+/// Saving all the entries waits for them to be written; otherwise they're only staged,
+/// to be written a few bytes at a time by Run.
+/// </remarks>
+void FMDebug::SaveTrace(bool all)
+{
+	uint8_t record[FMTraceStore::RecordLimit];
+	// walk to the oldest entry not yet saved
+	uint offset = TraceTail;
+	for (uint i = TraceEntries - TraceUnsaved; i != 0; --i)
+		offset = TraceNext(offset);
+	bool saved = false;
+	while (TraceUnsaved != 0)
 	{
-		// advance the tail through the circular buffer
-		if (++TraceTail >= TraceCount)
-			TraceTail = 0;
+		TRACE* t = TraceAt(offset);
+		uint len = t->len;
+		if (TraceRecordBytes + len > sizeof(record))
+			len = sizeof(record) - TraceRecordBytes;
+		if (!all && saved && !TraceStore->Fits(TraceRecordBytes + len))
+			break;
+		memcpy(record, &t->ms, sizeof(t->ms));
+		record[8] = t->id;
+		record[9] = t->cat;
+		record[10] = t->type;
+		record[11] = len;
+		memcpy(record + TraceRecordBytes, t + 1, len);
+		TraceStore->Append(record, TraceRecordBytes + len);
+		saved = true;
+		--TraceUnsaved;
+		offset = TraceNext(offset);
 	}
+	TraceStore->Commit();
+	if (all)
+		TraceStore->Sync();
 }
 
 /// <summary>Creates a string, suitable for output, of a TRACE log entry.</summary>
 /// <param name="i">The zero-based index of the desired log entry, oldest first.</param>
 /// <returns>The log entry string, or an empty string if there is no entry at that index.</returns>
 /// <remarks>
-/// The log entry index is zero for the oldest entry in the log and limited to TraceCount,
-/// the maximum number of entries in the log.
+/// The log entry index is zero for the oldest entry in the log. The number of entries the log can hold
+/// depends on the length of their arguments and the size of the arena, TraceBytes.
 /// </remarks>
 String FMDebug::PullTrace(uint i)
 {
-	i = (TraceTail + i) % TraceCount;
-	if (i == TraceHead)
+	if (i >= TraceEntries)
 		return "";
-	return TraceString(i);
+	// walk the entries from the oldest
+	uint offset = TraceTail;
+	while (i-- != 0)
+		offset = TraceNext(offset);
+	return TraceString(offset);
 }
 
+/// <summary>Print a value as little-endian hex bytes.</summary>
+/// <param name="v">The value.</param>
+/// <param name="bytes">The number of bytes to print.</param>
+static void PrintHex(uint64_t v, uint8_t bytes)
+{
+	while (bytes-- != 0)
+	{
+		uint8_t b = v & 0xFF;
+		if (b < 0x10)
+			debug.print('0');
+		debug.print(b, HEX);
+		v >>= 8;
+	}
+}
+
+/// <summary>Dump the Trace log as binary records, for decoding on the host.</summary>
+/// <remarks>
+/// The dump is framed by "<<<<b" and ">>>>" lines. Each record is a line of "T" followed by hex bytes:
+/// the timestamp (8 bytes), the message id (1), the category (1), the argument type (1),
+/// the argument length (1) and the argument bytes, with multi-byte values little-endian.
+/// See extras/TraceDecode.py, which gets the text of each message id from FMMessages.h.
+/// </remarks>
+void FMDebug::DumpTrace()
+{
+	debug.println(F("<<<<b"));
+	uint offset = TraceTail;
+	for (uint i = 0; i < TraceEntries; ++i)
+	{
+		TRACE* t = TraceAt(offset);
+		debug.print('T');
+		PrintHex(t->ms, 8);
+		PrintHex(t->id, 1);
+		PrintHex(t->cat, 1);
+		PrintHex(t->type, 1);
+		PrintHex(t->len, 1);
+		const uint8_t* a = (const uint8_t*)(t + 1);
+		for (uint8_t j = 0; j < t->len; ++j)
+			PrintHex(a[j], 1);
+		debug.println();
+		offset = TraceNext(offset);
+	}
+	debug.println(F(">>>>"));
+}
+
+// the size in bytes of the ring holding output waiting to be sent to the Serial device
+// (may be defined in the build to trade memory for tolerance of bursts of output)
+#ifndef TxBytes
+#define TxBytes 256
+#endif
+
+// in ms - the longest a Command's output waits for the Serial device to take some of the ring
+// (may be defined in the build)
+#ifndef TxBlockMS
+#define TxBlockMS 100
+#endif
+
+uint8_t TxRing[TxBytes];		// a circular buffer to hold output for the Serial device
+uint TxHead = 0;				// the index in the ring for the next byte of output
+uint TxTail = 0;				// the index in the ring of the oldest byte of output
+uint TxCount = 0;				// # bytes of output in the ring
+
+FMCounter TxQueued("txq", true);	// # bytes of output in the ring after draining
+
 /// <summary>Initialize (before adding to App).</summary>
 /// <param name="banner">The banner to be displayed on the serial output once connected.</param>
 /// <param name="wait">True if Setup should wait for Serial connection before proceeding.</param>
@@ -135,49 +494,65 @@ void FMDebug::Setup()
 		while (!CheckConnection())
 			;
 	}
+	if (TraceStore != NULL)
+		RecoverTrace();
 }
 
 /// <summary>Periodically poll activities for the Applet.</summary>
 void FMDebug::Run()
 {
-	// polling the Serial device can be quite costly in processor time,
-	// so we only check periodically using a Metronome timer
-	if (Timer)
+	// send queued output as the Serial device has room for it
+	Drain();
+
+	// write the batch of Trace entries being saved a few bytes at a time, and stage a new batch periodically,
+	// only while we're not busy with output
+	if (TraceStore != NULL && TxCount == 0 && TraceStore->Flush(TraceSaveBytes) && TraceUnsaved != 0 && StoreTimer)
+		SaveTrace(false);
+
+	// checking the Serial connection can be quite costly in processor time,
+	// so until connected we only check periodically using a Metronome timer
+	// once connected, the Reader polls for new Serial data often while it's arriving, and less often when idle
+	if (Connected ? Reader.Due() : Timer && CheckConnection())
 	{
-		// nothing to do if we're not connected
-		if (CheckConnection())
-		{
-			// check for new Serial data
-			while (Serial.available())
-			{
-				char c = Serial.read();
-				if (c == ';' || c == '\n' || c == '\r')
-				{
-					if (Buffer.length() > 0)
-					{
-						// hit terminator with non-empty buffer
-						// pass it to the Parent App who will vector it to the appropriate Applet
-						// (this may eventually come back to us as our own Input)
-						Parent->Input(Buffer);
-						// clear the buffer
-						// Note: this does not reduce the reserve capacity of the String in the current implementation
-						Buffer = "";
-					}
-				}
-				else
-				{
-					// buffer the character and keep looking for terminator
-					// Note: the String capacity will only grow as needed above our initial reserve amount (so maybe never)
-					Buffer.concat(c);
-				}
-			}
-		}
+		// pass each complete line to the Parent App who will vector it to the appropriate Applet
+		// (this may eventually come back to us as our own Input)
+		Reader.Read(Serial, Parent);
 	}
 
-	if (Metrics & Ready())
+	if (Metrics != Measuring)
+	{
+		// start or stop measuring, with the App timing each Applet to find the slowest
+		Measuring = Metrics;
+		Parent->Timing = Metrics;
+		ClearMetrics();
+		LastPass = micros();
+	}
+	else if (Measuring)
 	{
-		// count number of calls
+		// measure the time for the last pass through the loop
+		uint32_t now = micros();
+		uint32_t dt = now - LastPass;
+		LastPass = now;
 		++LoopCalls;
+		LoopSum += dt;
+		if (dt > LoopMax)
+			LoopMax = dt;
+		// bucket i of the histogram counts passes of 2^i to 2^(i+1) us
+		uint8_t b = 0;
+		for (uint32_t d = dt; d > 1 && b < LoopBuckets - 1; d >>= 1)
+			++b;
+		++LoopHist[b];
+		if (dt > OverrunMicros)
+		{
+			// log the overrun, with the prefix of the Applet that was slowest in that pass
+			++Overruns;
+			uint8_t args[1 + 2 * sizeof(uint32_t)];
+			args[0] = Parent->Slowest == NULL ? '?' : Parent->Slowest->Prefix;
+			uint32_t slowest = Parent->SlowestMicros;
+			memcpy(args + 1, &slowest, sizeof(slowest));
+			memcpy(args + 1 + sizeof(slowest), &dt, sizeof(dt));
+			Log(MsgOverrun, 0, TraceApplet, args, sizeof(args));
+		}
 	}
 
 	if (MetricsTimer)
@@ -188,19 +563,83 @@ void FMDebug::Run()
 			// toggle the debug LED as a heartbeat sign of life
 			digitalWrite(DebugLED, !digitalRead(DebugLED));
 		}
-		if (Metrics & Ready())
+		if (CounterReport)
+			ReportCounters();
+		if (Measuring && Ready() && LoopCalls != 0)
 		{
-			// output the number of calls in the last second and the average loop duration
-			debug.print("[", FMDateTime::Now().ToString());
-			debug.println("] calls: ", LoopCalls);
-			debug.println("..loop dur: ", 1000000L / LoopCalls);
-			// clear the count
-			LoopCalls = 0;
-			return;
+			// output the loop metrics for the last second on one line, with times in us:
+			// # passes, mean, 99th percentile (as the top of its bucket), max, # overruns, # bytes of output dropped,
+			// and the histogram buckets up to the last one used
+			uint32_t p99 = 0;
+			uint32_t rank = LoopCalls / 100;	// # passes slower than the 99th percentile
+			uint8_t last = 0;
+			for (int8_t b = LoopBuckets - 1; b >= 0; --b)
+			{
+				if (LoopHist[b] != 0 && last == 0)
+					last = b;
+				if (p99 == 0 && LoopHist[b] > rank)
+					p99 = 2UL << b;
+				rank -= LoopHist[b] > rank ? rank : LoopHist[b];
+			}
+			debug.print(F("loop n:"), LoopCalls);
+			debug.print(F(" avg:"), LoopSum / LoopCalls);
+			debug.print(F(" p99:"), p99);
+			debug.print(F(" max:"), LoopMax);
+			debug.print(F(" ovr:"), Overruns);
+			debug.print(F(" drop:"), TxDropped);
+			debug.print(F(" h:"));
+			for (uint8_t b = 0; b <= last; ++b)
+			{
+				if (b != 0)
+					debug.print(',');
+				debug.print(LoopHist[b]);
+			}
+			debug.println();
 		}
+		// start the next second afresh, whether or not the last was output
+		if (Measuring)
+			ClearMetrics();
 	}
 }
 
+/// <summary>Stream the changes to the FMCounters since the last report to the output Applet.</summary>
+/// <remarks>
+/// The report is a single message, "-=k" followed by "name:change" for each counter that changed,
+/// separated by commas. A gauge reports its new value rather than the change. Nothing is sent if nothing changed.
+/// </remarks>
+void FMDebug::ReportCounters()
+{
+	// the changes accumulate until the report can be sent
+	if (!Parent->Linked())
+		return;
+	String s;
+	for (FMCounter* c = FMCounter::First; c != NULL; c = c->Next)
+	{
+		uint32_t v = c->Value();
+		if (v == c->Reported)
+			continue;
+		if (s.length() != 0)
+			s += ',';
+		s += c->Name;
+		s += ':';
+		s += String(c->Gauge ? v : v - c->Reported);
+		c->Reported = v;
+	}
+	if (s.length() != 0)
+		Parent->Output(String(Prefix) + "=k" + s);
+}
+
+/// <summary>Clear the loop performance metrics for a new period.</summary>
+void FMDebug::ClearMetrics()
+{
+	LoopCalls = 0;
+	LoopSum = 0;
+	LoopMax = 0;
+	Overruns = 0;
+	for (uint8_t b = 0; b < LoopBuckets; ++b)
+		LoopHist[b] = 0;
+}
+
 /// <summary>Process a Command string.</summary>
 /// <param name="s">The Command string.</param>
 /// <remarks>
@@ -208,9 +647,20 @@ void FMDebug::Run()
 ///		'q' - Toggle the Quiet setting, which suppresses debug print output.
 ///		'm' - Toggle the Metrics setting, which outputs periodic loop performance metrics.
 ///		'l' - Dump the Trace log.
+///		'b' - Dump the Trace log as binary records, for decoding on the host.
+///		'e' - Set TraceEcho from the hex mask following the command, e.g. "-e03".
+///		'c' - Set LogCategories from the hex mask following the command, e.g. "-c0003".
+///		'o' - Set OverrunMicros from the decimal value following the command, e.g. "-o20000".
+///		'k' - Print a snapshot of the FMCounters.
+///		'K' - Toggle the CounterReport setting, which streams changes to the FMCounters to the output Applet.
+///		'x' - Toggle recording of the App loop timeline by fmTimeline (starting afresh), if built with FMTIMELINE.
+///		'X' - Dump the App loop timeline recorded by fmTimeline, if built with FMTIMELINE.
+///		'p' - Save all the new Trace entries to the TraceStore, and print its statistics.
+/// Output from a Command waits for room in the transmit ring rather than being dropped, so dumps are complete.
 /// </remarks>
 void FMDebug::Command(const String& s)
 {
+	Blocking = true;
 	switch (s[0])
 	{
 	case 'q':
@@ -224,7 +674,7 @@ void FMDebug::Command(const String& s)
 	case 'l':
 		{
 			// Dump the Trace log
-			debug.println("<<<<");
+			debug.println(F("<<<<"));
 			for (int i = 0; ; ++i)
 			{
 				String s = PullTrace(i);
@@ -232,13 +682,67 @@ void FMDebug::Command(const String& s)
 					break;
 				debug.println(s);
 			}
-			debug.println(">>>>");
+			debug.println(F(">>>>"));
 		}
 		break;
+	case 'b':
+		// Dump the Trace log as binary records
+		DumpTrace();
+		break;
+	case 'e':
+		// Set the categories of Trace entries to be output as they're logged
+		TraceEcho = strtoul(s.c_str() + 1, NULL, 16);
+		break;
+	case 'c':
+		// Set the categories of FMLOG output
+		LogCategories = strtoul(s.c_str() + 1, NULL, 16);
+		break;
+	case 'o':
+		// Set the loop time considered an overrun
+		OverrunMicros = strtoul(s.c_str() + 1, NULL, 10);
+		break;
+	case 'k':
+		// Print a snapshot of the counters
+		debug.println(F("<<<<"));
+		for (FMCounter* c = FMCounter::First; c != NULL; c = c->Next)
+		{
+			debug.print(c->Name);
+			debug.println(F(": "), c->Value());
+		}
+		debug.println(F(">>>>"));
+		break;
+	case 'K':
+		// Toggle the report of changes to the counters
+		CounterReport = !CounterReport;
+		break;
+#ifdef FMTIMELINE
+	case 'x':
+		// Toggle recording of the App loop timeline
+		if (fmTimeline.Recording)
+			fmTimeline.Recording = false;
+		else
+			fmTimeline.Start();
+		break;
+	case 'X':
+		// Dump the App loop timeline
+		fmTimeline.Dump();
+		break;
+#endif
+	case 'p':
+		// Save the Trace log to the store
+		if (TraceStore == NULL)
+			break;
+		SaveTrace(true);
+		// the # bytes of entries saved, # pages committed and # bytes written to the device (including headers)
+		debug.print(F("store saved:"), TraceStore->Saved);
+		debug.print(F(" commits:"), TraceStore->Commits);
+		debug.println(F(" written:"), TraceStore->Device.BytesWritten);
+		break;
 	default:
-		debug.println("invalid debug input: ", s[0]);
+		FMLOG_WARN(FMLOG_CAT_APP, "invalid debug input: ", s[0]);
 		break;
 	}
+	Blocking = false;
 }
 
 /// <summary>Determine if the debug object is Ready for output.</summary>
@@ -269,8 +773,120 @@ bool FMDebug::CheckConnection()
 	return Connected;
 }
 
-size_t FMDebug::write(uint8_t c) { if (Ready()) { Serial.write(c); } }
-size_t FMDebug::write(const uint8_t *buffer, size_t size) { if (Ready()) { Serial.write(buffer, size); } }
+/// <summary>Queue a byte of output for the Serial device.</summary>
+/// <param name="c">The byte.</param>
+/// <returns>The number of bytes queued.</returns>
+size_t FMDebug::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+/// <summary>Queue output for the Serial device.</summary>
+/// <param name="buffer">The bytes.</param>
+/// <param name="size">The number of bytes.</param>
+/// <returns>The number of bytes queued.</returns>
+/// <remarks>
+/// This never waits for the Serial device, except while Blocking for a Command. If the ring is full, either the
+/// new output or the oldest output in the ring is dropped, according to DropOldest. A Command waits for room instead,
+/// but if the Serial device takes nothing for TxBlockMS, it stops waiting for the rest of the Command.
+/// </remarks>
+size_t FMDebug::write(const uint8_t *buffer, size_t size)
+{
+	if (!Ready())
+		return 0;
+	if (Blocking)
+	{
+		// wait for room in the ring, rather than drop output, as long as the Serial device is taking it
+		uint32_t ms = millis();
+		while (TxCount != 0 && TxCount + size > TxBytes)
+		{
+			uint count = TxCount;
+			Drain();
+			if (TxCount != count)
+				ms = millis();
+			else if (millis() - ms >= TxBlockMS)
+			{
+				Blocking = false;
+				break;
+			}
+		}
+		if (size > TxBytes && TxCount == 0)
+			return Serial.write(buffer, size);	// too big for the ring, so send it directly
+	}
+	size_t n = size;
+	if (TxCount + size > TxBytes)
+	{
+		// overflow!
+		++TxOverflows;
+		if (DropOldest)
+		{
+			if (size > TxBytes)
+			{
+				// only the end of the output can fit
+				TxDropped += size - TxBytes;
+				buffer += size - TxBytes;
+				size = TxBytes;
+			}
+			// make room by dropping the oldest output
+			uint drop = TxCount + size - TxBytes;
+			TxDropped += drop;
+			TxTail = (TxTail + drop) % TxBytes;
+			TxCount -= drop;
+		}
+		else
+		{
+			// keep what fits and drop the rest of the new output
+			TxDropped += TxCount + size - TxBytes;
+			size = TxBytes - TxCount;
+			n = size;
+		}
+	}
+	for (size_t i = 0; i < size; ++i)
+	{
+		TxRing[TxHead] = buffer[i];
+		if (++TxHead >= TxBytes)
+			TxHead = 0;
+	}
+	TxCount += size;
+	return n;
+}
+
+/// <summary>Send queued output to the Serial device, as much as it has room for.</summary>
+void FMDebug::Drain()
+{
+	int room = Serial.availableForWrite();
+	while (TxCount != 0 && room > 0)
+	{
+		// send the contiguous output from the tail, up to the end of the ring
+		uint n = TxTail + TxCount > TxBytes ? TxBytes - TxTail : TxCount;
+		if (n > (uint)room)
+			n = room;
+		Serial.write(TxRing + TxTail, n);
+		TxTail = (TxTail + n) % TxBytes;
+		TxCount -= n;
+		room -= n;
+	}
+	TxQueued.Set(TxCount);
+}
+
+/// <summary>Send all queued output to the Serial device, waiting for it as necessary.</summary>
+/// <remarks>
+/// This is useful before something that stops the loop, like a reset. It shouldn't be used in a hot path.
+/// If the Serial device takes nothing for TxBlockMS, e.g. native USB with no host attached, it stops waiting.
+/// </remarks>
+void FMDebug::Flush()
+{
+	uint32_t ms = millis();
+	while (TxCount != 0)
+	{
+		uint count = TxCount;
+		Drain();
+		if (TxCount != count)
+			ms = millis();
+		else if (millis() - ms >= TxBlockMS)
+			break;
+	}
+}
 
 // implementations follow for a variety of print/ln functions for debug output.
 
@@ -34,13 +34,34 @@ An Applet that:
 
 #include <Metronome.h>
 #include <Applet.h>
+#include <LineReader.h>
+#include <FMCounter.h>
+#include <FMTimeline.h>
+#include <FMMessages.h>
+#include <FMTraceStore.h>
 
 /// <summary>An Applet implementation of the Serial IO device and other useful testing and debugging functionality.</summary>
 /// <remarks>
 /// Implements a variety of print/ln functions for debug output.
 /// Reads input Serial strings and processes them through the App.Input() method.
 /// Provides a Trace mechanism for logging time-stamped events and recalling them at a later time.
+/// Trace entries are logged as binary records, with a message id from the FMMessages table rather than its text,
+/// and are only formatted when output. Each has a category, 0-7,
+/// and only the categories selected by TraceEcho, none by default, are output as they're logged.
+/// The log can be dumped formatted, or as binary records to be decoded on the host by extras/TraceDecode.py.
+/// The log can be made persistent by setting TraceStore before Setup. New entries are then saved to the store
+/// in batches by Run, a page at a time and only while there's no output waiting, each written a few bytes per Run
+/// so the slow writes of an EEPROM don't hold up the loop, and the entries
+/// saved before a reset are recovered into the log by Setup, followed by a MsgRestart entry.
+/// Debug output is queued in a transmit ring and drained to the Serial device by Run, only as fast as the device
+/// has room, so printing never blocks. If the ring overflows, the newest or the oldest output is dropped,
+/// according to DropOldest, and counted in TxDropped.
+/// The FMLOG macros print to debug with a level and a category. Levels below FMLOG_LEVEL generate no code,
+/// and the arguments are only evaluated if the category is selected in LogCategories and output is Ready.
 /// Provides a mechanism for dumping loop-time metrics for performance evaluation.
+/// With Metrics on, the time of every pass through the loop is measured into a histogram of power-of-2 buckets,
+/// and a compact line with the pass count, mean, 99th percentile, max, overruns and histogram is output each second.
+/// A pass longer than OverrunMicros is an overrun, and is Traced with the Applet that was slowest in that pass.
 /// A SINGLE instance of the Debug class is declared as a global 'debug', to be used throughout the App.
 /// The 'debug' Applet should be initialized with a call to Init() before use.
 /// The 'debug' Applet should be the first added to the App so that the Serial device is properly Setup
@@ -50,7 +71,7 @@ class FMDebug : public Applet
 {
 public:
 	/// <summary>Constructor.</summary>
-	FMDebug() : Applet('-'), Timer(1000), MetricsTimer(1000) { Buffer = ""; Name = "Debug"; Buffer.reserve(10); }
+	FMDebug() : Applet('-'), Timer(1000), Reader(5, 200), MetricsTimer(1000), StoreTimer(1000) { Name = "Debug"; }
 
 	void Init(const char* banner, bool wait = false, int debugLED = -1);
 
@@ -59,32 +80,77 @@ public:
 	void Command(const String& s);
 
 	bool CheckConnection();
-
-	void Trace(const char* msg, const char* more = NULL);
-	void Trace(const char* msg, const String& more) { Trace(msg, more.c_str()); }
+	void Flush();
+	/// <summary>Determine if log output in a category is selected, before any arguments are formatted.</summary>
+	/// <param name="cat">The category, 0-15.</param>
+	bool Logging(uint8_t cat) { return (LogCategories & (1 << cat)) && Ready(); }
+
+	/// <summary>The type of the argument bytes recorded with a Trace log entry.</summary>
+	enum TraceArg
+	{
+		TraceNone = 0,		// no argument
+		TraceText = 's',	// null-terminated text
+		TraceLong = 'l',	// 32-bit signed integer
+		TraceULong = 'u',	// 32-bit unsigned integer
+		TraceFloat = 'f',	// 32-bit float
+		TraceApplet = 'a'	// an Applet prefix and two 32-bit unsigned times
+	};
+
+	void Trace(FMMessage id, const char* more = NULL, uint8_t cat = 0);
+	void Trace(FMMessage id, const String& more, uint8_t cat = 0) { Trace(id, more.c_str(), cat); }
+	void Trace(FMMessage id, int v, uint8_t cat = 0) { Trace(id, (long)v, cat); }
+	void Trace(FMMessage id, long v, uint8_t cat = 0);
+	void Trace(FMMessage id, unsigned long v, uint8_t cat = 0);
+	void Trace(FMMessage id, double v, uint8_t cat = 0);
+	void Trace(const char* msg, const char* more = NULL, uint8_t cat = 0);
+	void Trace(const char* msg, const String& more, uint8_t cat = 0) { Trace(msg, more.c_str(), cat); }
 	String PullTrace(uint i);
+	void DumpTrace();
 
 
 	bool		Quiet = false;		// Set to true to suppress debug print output
 	bool		Metrics = false;	// Set to true to enable output of loop performance metrics
+	uint8_t		TraceEcho = 0;		// Bit mask of the Trace categories to be output as they're logged (none by default)
+	uint16_t	LogCategories = 0xFFFF;	// Bit mask of the FMLOG categories to be output
+	uint32_t	OverrunMicros = 10000;	// in us - loop time above which a pass is Traced as an overrun
+	bool		CounterReport = false;	// Set to true to stream changes to the FMCounters to the output Applet
+	bool		DropOldest = false;	// Set to true to drop the oldest output, rather than the newest, on overflow
+	uint32_t	TxDropped = 0;		// # bytes of output dropped on overflow
+	uint32_t	TxOverflows = 0;	// # writes that overflowed
+	FMTraceStore* TraceStore = NULL;	// The store to make the Trace log persistent (NULL if none)
 
 	size_t		write(uint8_t c);
 	size_t		write(const uint8_t *buffer, size_t size);
 
 private:
-	String TraceString(uint inx);
+	String TraceString(uint offset);
+	void RecoverTrace();
+	void SaveTrace(bool all);
+	void Log(FMMessage id, uint8_t cat, char type, const void* args, uint len, const char* text = NULL);
 
 	bool		Wait;				// True to wait for Serial connection before leaving Setup
 	const char* Banner;				// Banner to output when Serial connection is made
-	Metronome	Timer;				// Timer for polling Serial connection and input
+	Metronome	Timer;				// Timer for polling Serial connection
+	LineReader	Reader;				// Reader for assembling input lines from the Serial device
 	bool		Connected = false;	// Record of the last known Connected state for the Serial device
-	String		Buffer;				// Buffer to receive characters from the Serial device
 
 	Metronome	MetricsTimer;		// Timer for the output of loop performance metrics
+	Metronome	StoreTimer;			// Timer for saving batches of Trace entries to the TraceStore
+	static const uint8_t LoopBuckets = 16;	// # buckets in the loop time histogram
+	bool		Measuring = false;	// True while loop performance metrics are being measured
+	uint32_t	LastPass;			// in us - time of the start of the last pass through the loop
 	uint32_t	LoopCalls = 0;		// Counts number of calls to Run for Metrics
+	uint32_t	LoopSum = 0;		// in us - total time of the passes counted
+	uint32_t	LoopMax = 0;		// in us - longest time of the passes counted
+	uint16_t	Overruns = 0;		// # passes longer than OverrunMicros
+	uint32_t	LoopHist[LoopBuckets];	// # passes in each power-of-2 bucket of loop time
 	int			DebugLED;			// The LED pin to be toggled periodically as a sign of life. (-1 if none.)
 
 	bool Ready();
+	void Drain();
+	bool Blocking = false;			// True while a Command is running, to wait (up to TxBlockMS) for room for output rather than drop it
+	void ClearMetrics();
+	void ReportCounters();
 };
 
 // The SINGLE instance of the FMDebug Applet for global use
@@ -93,8 +159,8 @@ extern FMDebug	fmDebug;
 class Debug : public Print
 {
 public:
-	size_t		write(uint8_t c) { fmDebug.write(c); }
-	size_t		write(const uint8_t *buffer, size_t size) { fmDebug.write(buffer, size); }
+	size_t		write(uint8_t c) { return fmDebug.write(c); }
+	size_t		write(const uint8_t *buffer, size_t size) { return fmDebug.write(buffer, size); }
 
 	// pull in write(str) and write(buf, size) from Print
 	using Print::write;
@@ -124,10 +190,51 @@ public:
 	void println(const char s[], unsigned long, int = DEC);
 	void println(const char s[], double, int = 2);
 	void println(const char s[], const Printable&);
+
+	// print/ln a label in program memory, e.g. F("label: "), followed by a value
+	template <class T> void print(const __FlashStringHelper* s, const T& v) { print(s); print(v); }
+	template <class T> void print(const __FlashStringHelper* s, const T& v, int p) { print(s); print(v, p); }
+	template <class T> void println(const __FlashStringHelper* s, const T& v) { print(s); println(v); }
+	template <class T> void println(const __FlashStringHelper* s, const T& v, int p) { print(s); println(v, p); }
 };
 
 // The SINGLE instance of Debug for global use
 extern Debug	debug;
 
+// FMLOG levels, in increasing severity
+#define FMLOG_LEVEL_TRACE	0
+#define FMLOG_LEVEL_DEBUG	1
+#define FMLOG_LEVEL_INFO	2
+#define FMLOG_LEVEL_WARN	3
+#define FMLOG_LEVEL_ERROR	4
+#define FMLOG_LEVEL_NONE	5
+
+// the least FMLOG level compiled into the build
+// (may be defined in the build to remove more or less logging)
+#ifndef FMLOG_LEVEL
+#define FMLOG_LEVEL			FMLOG_LEVEL_DEBUG
+#endif
+
+// standard FMLOG categories, selected by the bits of fmDebug.LogCategories
+// (Apps may use categories 8-15 for their own purposes)
+#define FMLOG_CAT_APP		0	// App and Applet input processing
+#define FMLOG_CAT_COMM		1	// communications devices
+#define FMLOG_CAT_MOTION	2	// steppers and motion control
+#define FMLOG_CAT_CAMERA	3	// camera control
+
+// Execute the following statement only if logging is enabled for a level and category, e.g.
+//	FMLOG_IF(FMLOG_LEVEL_WARN, FMLOG_CAT_APP) { debug.print(Name); debug.println(F(" warning")); }
+// The level must be a constant; below FMLOG_LEVEL the statement is removed by the compiler.
+#define FMLOG_IF(level, cat)	if ((level) >= FMLOG_LEVEL && fmDebug.Logging(cat))
+
+// Print a line to debug, with the arguments of a debug.println, if logging is enabled for a level and category
+// The first argument must be a string literal, which is kept in program memory.
+#define FMLOG(level, cat, msg, ...)	do { FMLOG_IF(level, cat) debug.println(F(msg), ##__VA_ARGS__); } while (0)
+#define FMLOG_TRACE(cat, ...)	FMLOG(FMLOG_LEVEL_TRACE, cat, __VA_ARGS__)
+#define FMLOG_DEBUG(cat, ...)	FMLOG(FMLOG_LEVEL_DEBUG, cat, __VA_ARGS__)
+#define FMLOG_INFO(cat, ...)	FMLOG(FMLOG_LEVEL_INFO, cat, __VA_ARGS__)
+#define FMLOG_WARN(cat, ...)	FMLOG(FMLOG_LEVEL_WARN, cat, __VA_ARGS__)
+#define FMLOG_ERROR(cat, ...)	FMLOG(FMLOG_LEVEL_ERROR, cat, __VA_ARGS__)
+
 #endif
 
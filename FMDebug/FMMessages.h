@@ -0,0 +1,46 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMMessages_h
+#define _FMMessages_h
+
+/*
+The table of Trace messages.
+Each message is an id, used in the code and stored in Trace records, and its text, kept in program memory.
+extras/TraceDecode.py reads this table to decode binary Trace dumps on the host,
+so new messages must be added at the end to keep the ids of older dumps.
+*/
+#define FMMESSAGES(M) \
+	M(MsgText,			"")						/* text logged with Trace(const char*, ...) */ \
+	M(MsgOverrun,		"overrun: ")			/* loop overrun: slowest Applet's prefix, its time / the pass time (us) */ \
+	M(MsgConnected,		"BLE connected")		/* Bluetooth connection made */ \
+	M(MsgDisconnected,	"BLE disconnected")		/* Bluetooth connection lost */ \
+	M(MsgRestart,		"restart: ")			/* Setup after a reset: # Trace records recovered from the TraceStore */
+
+/// <summary>The ids of the Trace messages.</summary>
+enum FMMessage : uint8_t
+{
+#define FMMESSAGE_ID(id, text) id,
+	FMMESSAGES(FMMESSAGE_ID)
+#undef FMMESSAGE_ID
+	FMMessageCount
+};
+
+const __FlashStringHelper* FMMessageText(FMMessage id);
+
+#endif
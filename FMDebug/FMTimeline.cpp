@@ -0,0 +1,90 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMTimeline.h"
+#include <FMDebug.h>
+
+#ifdef FMTIMELINE
+
+// The SINGLE instance of FMTimeline for global use
+FMTimeline fmTimeline;
+
+/// <summary>Clear the recorded events and start Recording.</summary>
+void FMTimeline::Start()
+{
+	Head = 0;
+	Count = 0;
+	Recording = true;
+}
+
+/// <summary>Record an event.</summary>
+/// <param name="what">The Activity.</param>
+/// <param name="applet">The Applet performing the activity.</param>
+/// <param name="end">True for the end of the activity, false for the beginning.</param>
+void FMTimeline::Record(char what, Applet* applet, bool end)
+{
+	Event& e = Events[Head];
+	e.Time = micros();
+	e.Who = applet;
+	e.What = what;
+	e.End = end;
+	if (++Head >= TimelineEvents)
+		Head = 0;
+	if (Count < TimelineEvents)
+		++Count;
+}
+
+/// <summary>Dump the recorded events to the debug output.</summary>
+/// <remarks>
+/// The dump is framed by "<<<<x" and ">>>>" lines. Each event, oldest first, is a line of the time in us,
+/// the Activity, 'B' or 'E' for its beginning or end, and the Applet's Prefix, e.g. "123456,RB,s".
+/// The first event for each Applet is preceded by a line of "N", the Prefix, ':' and the Applet's Name.
+/// Recording is suspended during the dump.
+/// </remarks>
+void FMTimeline::Dump()
+{
+	bool recording = Recording;
+	Recording = false;
+	debug.println(F("<<<<x"));
+	uint first = (Head + TimelineEvents - Count) % TimelineEvents;
+	for (uint i = 0; i < Count; ++i)
+	{
+		Event& e = Events[(first + i) % TimelineEvents];
+		// name the Applet the first time it's seen
+		uint j = 0;
+		while (j < i && Events[(first + j) % TimelineEvents].Who != e.Who)
+			++j;
+		if (j == i)
+		{
+			debug.print('N');
+			debug.print(e.Who->Prefix);
+			debug.print(':');
+			debug.println(e.Who->Name != NULL ? e.Who->Name : "");
+		}
+		debug.print(e.Time);
+		debug.print(',');
+		debug.print(e.What);
+		debug.print(e.End ? 'E' : 'B');
+		debug.print(',');
+		debug.println(e.Who->Prefix);
+	}
+	debug.println(F(">>>>"));
+	Recording = recording;
+}
+
+#endif
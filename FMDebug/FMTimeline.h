@@ -0,0 +1,116 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMTimeline_h
+#define _FMTimeline_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <Applet.h>
+
+// define FMTIMELINE in the build to include the timeline recorder
+// (it's always included in the Linux simulation)
+#if !defined(ARDUINO) && !defined(FMTIMELINE)
+#define FMTIMELINE
+#endif
+
+// the number of events held by the timeline recorder
+// (may be defined in the build; small by default on a device, where each event takes 8 bytes or more)
+#ifndef TimelineEvents
+#if defined(ARDUINO)
+#define TimelineEvents 32
+#else
+#define TimelineEvents 128
+#endif
+#endif
+
+#ifdef FMTIMELINE
+
+/// <summary>A recorder of the App loop timeline, for viewing as a Chrome trace.</summary>
+/// <remarks>
+/// While Recording, the App logs the begin and end times, in microseconds, of each Applet's Run,
+/// of the dispatch of each Input to an Applet, and of each Output, into a fixed ring of the latest events.
+/// The FMDebug 'X' command dumps the ring, to be converted to Chrome trace-event JSON by
+/// extras/TimelineToChrome.py and opened in Perfetto or chrome://tracing.
+/// When not Recording, the only cost is a test of Recording in each pass of the App.
+/// Without FMTIMELINE, the recorder and the App's calls to it through the FMTIMELINE_ macros are left out of the build.
+/// A SINGLE instance of FMTimeline is declared as a global 'fmTimeline'.
+/// </remarks>
+class FMTimeline
+{
+public:
+	/// <summary>The kind of activity recorded.</summary>
+	enum Activity
+	{
+		Run = 'R',		// an Applet's Run
+		Input = 'I',	// an Input dispatched to an Applet
+		Output = 'O'	// an Output through the OutputApplet
+	};
+
+	/// <summary>Record the beginning of an activity, if Recording.</summary>
+	/// <param name="what">The Activity.</param>
+	/// <param name="applet">The Applet performing the activity.</param>
+	void		Begin(char what, Applet* applet) { if (Recording) Record(what, applet, false); }
+	/// <summary>Record the end of an activity, if Recording.</summary>
+	/// <param name="what">The Activity.</param>
+	/// <param name="applet">The Applet performing the activity.</param>
+	void		End(char what, Applet* applet) { if (Recording) Record(what, applet, true); }
+
+	void		Start();
+	void		Dump();
+
+	bool		Recording = false;		// Set to true (or use Start) to record events
+
+private:
+	void		Record(char what, Applet* applet, bool end);
+
+	/// <summary>A recorded event.</summary>
+	struct Event
+	{
+		uint32_t	Time;		// in us - time of the event
+		Applet*		Who;		// the Applet performing the activity
+		char		What;		// the Activity
+		bool		End;		// true for the end of the activity, false for the beginning
+	};
+
+	Event		Events[TimelineEvents];	// circular buffer of the latest events
+	uint		Head = 0;				// the index for the next event
+	uint		Count = 0;				// # events recorded
+};
+
+// The SINGLE instance of FMTimeline for global use
+extern FMTimeline fmTimeline;
+
+// Record an activity of an Applet on the timeline, e.g. FMTIMELINE_BEGIN(Run, a)
+#define FMTIMELINE_RECORDING			fmTimeline.Recording
+#define FMTIMELINE_BEGIN(what, applet)	fmTimeline.Begin(FMTimeline::what, applet)
+#define FMTIMELINE_END(what, applet)	fmTimeline.End(FMTimeline::what, applet)
+
+#else
+
+#define FMTIMELINE_RECORDING			false
+#define FMTIMELINE_BEGIN(what, applet)
+#define FMTIMELINE_END(what, applet)
+
+#endif
+
+#endif
@@ -0,0 +1,396 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMTraceStore.h"
+#if defined(__AVR__)
+#include <EEPROM.h>
+#endif
+#if !defined(ARDUINO)
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/// <summary>Accumulate bytes into a CRC-8 (polynomial 0x07).</summary>
+/// <param name="crc">The CRC of the bytes so far.</param>
+/// <param name="data">The bytes to add.</param>
+/// <param name="len">The number of bytes.</param>
+/// <returns>The CRC including the bytes.</returns>
+static uint8_t Crc8(uint8_t crc, const void* data, uint len)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	while (len-- != 0)
+	{
+		crc ^= *p++;
+		for (uint8_t b = 0; b < 8; ++b)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+/// <summary>Get the CRC of a page header.</summary>
+/// <param name="crc">The CRC of the records in the page.</param>
+/// <param name="seq">The sequence # of the page.</param>
+/// <param name="used">The # bytes of records in the page.</param>
+/// <returns>The CRC of the records and the header fields.</returns>
+static uint8_t PageCrc(uint8_t crc, uint32_t seq, uint8_t used)
+{
+	crc = Crc8(crc, &seq, sizeof(seq));
+	return Crc8(crc, &used, sizeof(used));
+}
+
+/// <summary>Read the headers of a page and find the latest that's valid.</summary>
+/// <param name="page">The index of the page.</param>
+/// <param name="seq">Receives the sequence # of the page.</param>
+/// <param name="used">Receives the # bytes of records in the page.</param>
+/// <param name="crc">Receives the CRC of the records in the page.</param>
+/// <param name="slot">Receives the slot of the header.</param>
+/// <returns>True if either header matches the records in the page.</returns>
+/// <remarks>
+/// A header is valid if its CRC matches the records it covers. Of two valid headers, the one with the newer sequence #,
+/// or with the same one and more bytes used, is the latest.
+/// </remarks>
+bool FMTraceStore::Valid(uint page, uint32_t& seq, uint8_t& used, uint8_t& crc, uint8_t& slot)
+{
+	uint32_t addr = (uint32_t)page * TraceStorePage;
+	uint8_t header[2][HeaderBytes];
+	Device.Read(addr, header, sizeof(header));
+	// the most bytes of records either header could cover
+	uint8_t most = 0;
+	for (uint8_t s = 0; s < 2; ++s)
+	{
+		if (header[s][4] <= PayloadBytes && header[s][4] > most)
+			most = header[s][4];
+	}
+	// accumulate the CRC of the records, checking each header at the bytes it covers (erased headers are all ones)
+	bool found = false;
+	uint8_t c = 0;
+	for (uint i = 0; ; ++i)
+	{
+		for (uint8_t s = 0; s < 2; ++s)
+		{
+			uint32_t q;
+			memcpy(&q, header[s], sizeof(q));
+			if (header[s][4] != i || q == 0xFFFFFFFF || PageCrc(c, q, i) != header[s][5])
+				continue;
+			if (!found || q > seq || (q == seq && i > used))
+			{
+				found = true;
+				seq = q;
+				used = i;
+				crc = c;
+				slot = s;
+			}
+		}
+		if (i == most)
+			break;
+		uint8_t b;
+		Device.Read(addr + RecordsAt + i, &b, 1);
+		c = Crc8(c, &b, 1);
+	}
+	return found;
+}
+
+/// <summary>Find the newest page in the store, to continue the log from there.</summary>
+/// <remarks>
+/// If the store holds no valid pages, the log starts afresh at the first page.
+/// </remarks>
+void FMTraceStore::Open()
+{
+	Page = 0;
+	Seq = 1;
+	Used = 0;
+	Crc = 0;
+	Dirty = false;
+	HeaderPending = false;
+	HeaderWritten = HeaderBytes;
+	Slot = 1;
+	Stale = 0;
+	bool found = false;
+	for (uint p = 0; p < Pages(); ++p)
+	{
+		uint32_t seq;
+		uint8_t used, crc, slot;
+		if (Valid(p, seq, used, crc, slot) && (!found || seq > Seq))
+		{
+			found = true;
+			Page = p;
+			Seq = seq;
+			Used = used;
+			Crc = crc;
+			Slot = slot;
+		}
+	}
+	Written = Used;
+}
+
+/// <summary>Append a record to the log, moving on to the next page if it doesn't fit in the current one.</summary>
+/// <param name="record">The record.</param>
+/// <param name="len">The length of the record, no more than RecordLimit.</param>
+/// <remarks>
+/// The record is staged to be written by Flush, and is not recovered after a reset until the page is Committed
+/// and its header written.
+/// </remarks>
+void FMTraceStore::Append(const void* record, uint len)
+{
+	if (len > RecordLimit)
+		len = RecordLimit;
+	if (!Fits(len))
+	{
+		// finish the current page and start on the next (oldest) one
+		Commit();
+		Sync();
+		Page = (Page + 1) % Pages();
+		++Seq;
+		Used = 0;
+		Written = 0;
+		Crc = 0;
+		Stale = 2;
+	}
+	uint8_t n = len;
+	Stage[Used] = n;
+	memcpy(Stage + Used + 1, record, len);
+	Crc = Crc8(Crc8(Crc, &n, 1), record, len);
+	Used += 1 + len;
+	Saved += len;
+	Dirty = true;
+}
+
+/// <summary>Commit the records appended to the current page, by staging a new header to be written.</summary>
+void FMTraceStore::Commit()
+{
+	if (!Dirty)
+		return;
+	HeaderPending = true;
+	Dirty = false;
+	++Commits;
+}
+
+/// <summary>Write some of the records and header staged for the current page to the device.</summary>
+/// <param name="bytes">The most bytes to write.</param>
+/// <returns>True if everything staged has been written.</returns>
+/// <remarks>
+/// Writing stops early if the device isn't Ready, so it never waits for the device.
+/// The records are written before the header, which covers all the records written when it's begun,
+/// and goes in the slot not holding the latest header, so the latest survives if writing the new one is cut short.
+/// </remarks>
+bool FMTraceStore::Flush(uint bytes)
+{
+	uint32_t addr = (uint32_t)Page * TraceStorePage;
+	for (; bytes != 0 && Device.Ready(); --bytes)
+	{
+		if (HeaderWritten < HeaderBytes)
+		{
+			// finish the header begun
+			Device.Write(addr + Slot * HeaderBytes + HeaderWritten, Header + HeaderWritten, 1);
+			++HeaderWritten;
+		}
+		else if (Stale != 0)
+		{
+			// spoil the headers left from the page's last time round, by marking them as using more bytes than there are,
+			// the latest last, so until then the page is still recovered as it was
+			uint32_t seq;
+			uint8_t used, crc;
+			if (Stale == 2 && !Valid(Page, seq, used, crc, Slot))
+				Slot = 0;
+			Slot ^= 1;
+			uint8_t spoil = 0xFF;
+			Device.Write(addr + Slot * HeaderBytes + 4, &spoil, 1);
+			--Stale;
+		}
+		else if (Written < Used)
+		{
+			Device.Write(addr + RecordsAt + Written, Stage + Written, 1);
+			++Written;
+		}
+		else if (HeaderPending)
+		{
+			// begin the header, once the records it covers are written
+			memcpy(Header, &Seq, sizeof(Seq));
+			Header[4] = Used;
+			Header[5] = PageCrc(Crc, Seq, Used);
+			Slot ^= 1;
+			HeaderWritten = 0;
+			HeaderPending = false;
+			++bytes;			// (nothing written yet)
+		}
+		else
+			break;
+	}
+	return HeaderWritten == HeaderBytes && Stale == 0 && Written == Used && !HeaderPending;
+}
+
+/// <summary>Write everything staged for the current page to the device, waiting for it as necessary.</summary>
+void FMTraceStore::Sync()
+{
+	while (!Flush(PayloadBytes + HeaderBytes))
+		;
+}
+
+/// <summary>Start reading the records in the store, from the oldest.</summary>
+void FMTraceStore::Rewind()
+{
+	ReadPage = 0;
+	ReadOffset = 0;
+	ReadUsed = 0;
+}
+
+/// <summary>Read the next record in the store.</summary>
+/// <param name="record">The buffer to receive the record.</param>
+/// <param name="size">The size of the buffer. Longer records are truncated.</param>
+/// <returns>The length of the record, or zero if there are no more.</returns>
+/// <remarks>
+/// The pages are read round-robin from the one following the newest, skipping any that aren't valid.
+/// </remarks>
+uint FMTraceStore::Read(void* record, uint size)
+{
+	uint pages = Pages();
+	uint page = (Page + ReadPage) % pages;
+	while (ReadOffset >= ReadUsed)
+	{
+		// move on to the next valid page
+		if (ReadPage == pages)
+			return 0;
+		++ReadPage;
+		page = (Page + ReadPage) % pages;
+		uint32_t seq;
+		uint8_t crc, slot;
+		ReadOffset = 0;
+		if (!Valid(page, seq, ReadUsed, crc, slot) || seq > Seq)
+			ReadUsed = 0;
+	}
+	uint32_t addr = (uint32_t)page * TraceStorePage + RecordsAt + ReadOffset;
+	uint8_t len;
+	Device.Read(addr, &len, 1);
+	ReadOffset += 1 + len;
+	if (ReadOffset > ReadUsed)
+	{
+		// a length that runs past the records can only be corruption
+		ReadOffset = ReadUsed;
+		return 0;
+	}
+	Device.Read(addr + 1, record, len < size ? len : size);
+	return len;
+}
+
+#if defined(__AVR__)
+/// <summary>Read bytes from the EEPROM region.</summary>
+/// <param name="addr">The address of the first byte in the region.</param>
+/// <param name="buffer">The buffer to receive the bytes.</param>
+/// <param name="len">The number of bytes.</param>
+void FMEEPROMStorage::Read(uint32_t addr, void* buffer, uint len)
+{
+	uint8_t* p = (uint8_t*)buffer;
+	for (uint i = 0; i < len; ++i)
+		p[i] = EEPROM.read(Base + addr + i);
+}
+
+/// <summary>Write bytes to the EEPROM region, only changing the bytes that differ.</summary>
+/// <param name="addr">The address of the first byte in the region.</param>
+/// <param name="buffer">The bytes to be written.</param>
+/// <param name="len">The number of bytes.</param>
+void FMEEPROMStorage::Write(uint32_t addr, const void* buffer, uint len)
+{
+	const uint8_t* p = (const uint8_t*)buffer;
+	for (uint i = 0; i < len; ++i)
+	{
+		if (EEPROM.read(Base + addr + i) != p[i])
+		{
+			EEPROM.write(Base + addr + i, p[i]);
+			++BytesWritten;
+		}
+	}
+}
+
+/// <summary>Determine if the EEPROM can be written without waiting for a write in progress.</summary>
+bool FMEEPROMStorage::Ready()
+{
+	return eeprom_is_ready();
+}
+#endif
+
+#if !defined(ARDUINO)
+/// <summary>Constructor, opening the file or creating it as an erased device.</summary>
+/// <param name="path">The path of the file.</param>
+/// <param name="size">The size of the device in bytes.</param>
+FMFileStorage::FMFileStorage(const char* path, uint32_t size) : Bytes(size)
+{
+	File = fopen(path, "r+b");
+	if (File == NULL)
+	{
+		File = fopen(path, "w+b");
+		for (uint32_t i = 0; i < size; ++i)
+			fputc(0xFF, File);
+		fflush(File);
+	}
+	CellWrites = (uint32_t*)calloc(size, sizeof(uint32_t));
+}
+
+/// <summary>Destructor, closing the file.</summary>
+FMFileStorage::~FMFileStorage()
+{
+	fclose(File);
+	free(CellWrites);
+}
+
+/// <summary>Read bytes from the file.</summary>
+/// <param name="addr">The address of the first byte.</param>
+/// <param name="buffer">The buffer to receive the bytes.</param>
+/// <param name="len">The number of bytes.</param>
+void FMFileStorage::Read(uint32_t addr, void* buffer, uint len)
+{
+	memset(buffer, 0xFF, len);
+	fseek(File, addr, SEEK_SET);
+	fread(buffer, 1, len, File);
+}
+
+/// <summary>Write bytes to the file, only changing the bytes that differ, as EEPROM would.</summary>
+/// <param name="addr">The address of the first byte.</param>
+/// <param name="buffer">The bytes to be written.</param>
+/// <param name="len">The number of bytes.</param>
+void FMFileStorage::Write(uint32_t addr, const void* buffer, uint len)
+{
+	const uint8_t* p = (const uint8_t*)buffer;
+	for (uint i = 0; i < len && !Crashed; ++i)
+	{
+		uint8_t b;
+		Read(addr + i, &b, 1);
+		if (b == p[i])
+			continue;
+		if (CrashAfter != 0 && --CrashAfter == 0)
+			Crashed = true;
+		fseek(File, addr + i, SEEK_SET);
+		fputc(p[i], File);
+		++BytesWritten;
+		++CellWrites[addr + i];
+	}
+	fflush(File);
+}
+
+/// <summary>Get the wear on the most-written byte of the device.</summary>
+/// <returns>The # writes to the byte.</returns>
+uint32_t FMFileStorage::MaxCellWrites()
+{
+	uint32_t max = 0;
+	for (uint32_t i = 0; i < Bytes; ++i)
+	{
+		if (CellWrites[i] > max)
+			max = CellWrites[i];
+	}
+	return max;
+}
+#endif
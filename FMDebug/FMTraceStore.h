@@ -0,0 +1,176 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMTraceStore_h
+#define _FMTraceStore_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#if !defined(ARDUINO)
+#include <stdio.h>
+#endif
+
+// the size in bytes of a page of the persistent Trace log, including its header
+// (may be defined in the build; a record must fit in a page, so this limits the length of Trace text that's saved)
+#ifndef TraceStorePage
+#define TraceStorePage 64
+#endif
+
+/// <summary>A byte-addressable non-volatile storage device, holding a persistent Trace log.</summary>
+/// <remarks>
+/// Writes should only change the bytes that differ, as EEPROM.update does, so that unchanged cells aren't worn.
+/// </remarks>
+class FMStorage
+{
+public:
+	/// <summary>Get the size of the device.</summary>
+	/// <returns>The size in bytes.</returns>
+	virtual uint32_t Size() = 0;
+	/// <summary>Read bytes from the device.</summary>
+	/// <param name="addr">The address of the first byte.</param>
+	/// <param name="buffer">The buffer to receive the bytes.</param>
+	/// <param name="len">The number of bytes.</param>
+	virtual void Read(uint32_t addr, void* buffer, uint len) = 0;
+	/// <summary>Write bytes to the device.</summary>
+	/// <param name="addr">The address of the first byte.</param>
+	/// <param name="buffer">The bytes to be written.</param>
+	/// <param name="len">The number of bytes.</param>
+	virtual void Write(uint32_t addr, const void* buffer, uint len) = 0;
+	/// <summary>Determine if a byte can be written without waiting for the device.</summary>
+	virtual bool Ready() { return true; }
+
+	uint32_t	BytesWritten = 0;	// # bytes physically written to the device (changed)
+};
+
+#if defined(__AVR__)
+/// <summary>A region of the AVR EEPROM as an FMStorage device.</summary>
+class FMEEPROMStorage : public FMStorage
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="base">The address of the region in the EEPROM.</param>
+	/// <param name="size">The size of the region in bytes.</param>
+	FMEEPROMStorage(uint base, uint size) : Base(base), Bytes(size) { }
+
+	uint32_t Size() { return Bytes; }
+	void Read(uint32_t addr, void* buffer, uint len);
+	void Write(uint32_t addr, const void* buffer, uint len);
+	bool Ready();
+
+private:
+	uint		Base;				// the address of the region in the EEPROM
+	uint		Bytes;				// the size of the region in bytes
+};
+#endif
+
+#if !defined(ARDUINO)
+/// <summary>A file standing in for an EEPROM FMStorage device, for testing the persistent Trace log on a host.</summary>
+/// <remarks>
+/// Each write is flushed to the file, so a process that's killed leaves the device as it was at that moment.
+/// CrashAfter simulates a loss of power partway through a write, and the number of writes to each byte
+/// is counted to measure the wear.
+/// </remarks>
+class FMFileStorage : public FMStorage
+{
+public:
+	FMFileStorage(const char* path, uint32_t size);
+	~FMFileStorage();
+
+	uint32_t Size() { return Bytes; }
+	void Read(uint32_t addr, void* buffer, uint len);
+	void Write(uint32_t addr, const void* buffer, uint len);
+	uint32_t MaxCellWrites();
+
+	uint32_t	CrashAfter = 0;		// if not zero, the # bytes to write before all further writes are lost
+
+private:
+	FILE*		File;				// the file holding the device contents
+	uint32_t	Bytes;				// the size of the device in bytes
+	uint32_t*	CellWrites;			// # writes to each byte of the device
+	bool		Crashed = false;	// true after CrashAfter bytes have been written
+};
+#endif
+
+/// <summary>A log-structured, wear-levelled store of Trace records on an FMStorage device.</summary>
+/// <remarks>
+/// The device is divided into pages of TraceStorePage bytes, which are filled in turn, round-robin,
+/// so that writes are spread evenly over the device, and the oldest page is reused when the device is full.
+/// Each page has two header slots, each with a sequence number, the # bytes used, and a CRC of both and the records,
+/// followed by the records, each preceded by its length. Records are appended after the bytes used,
+/// and then Commit writes a new header to the slot not holding the latest one, so a page that's torn by a reset
+/// is recovered as it was at the last Commit whose header was written whole: the valid header with the newer
+/// sequence #, or the same one and more bytes used, is the one that counts. The headers left in a page from its
+/// last time round are spoiled before any records are written to it, so they can't pass for the new records.
+/// Appended records and the header are staged in memory and written to the device a few bytes at a time by Flush,
+/// the records first and the header last, since each byte written to an EEPROM takes milliseconds.
+/// Sync writes them all, waiting for the device. Moving on to a new page Syncs the current one first.
+/// Open finds the newest page at startup, and Rewind and Read then recover the records, oldest first.
+/// </remarks>
+class FMTraceStore
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="device">The storage device, which must hold at least two pages.</param>
+	FMTraceStore(FMStorage& device) : Device(device) { }
+
+	static const uint HeaderBytes = 6;							// the size of a page header
+	static const uint RecordsAt = 2 * HeaderBytes;				// the offset of the records in a page, after its two header slots
+	static const uint PayloadBytes = TraceStorePage - RecordsAt;	// the bytes available for records in a page
+	static const uint RecordLimit = PayloadBytes - 1;			// the longest record that can be stored
+
+	void Open();
+	/// <summary>Determine if a record will fit in the current page.</summary>
+	/// <param name="len">The length of the record.</param>
+	bool Fits(uint len) { return Used + 1 + len <= PayloadBytes; }
+	void Append(const void* record, uint len);
+	void Commit();
+	bool Flush(uint bytes);
+	void Sync();
+	void Rewind();
+	uint Read(void* record, uint size);
+
+	uint32_t	Saved = 0;			// # record bytes appended
+	uint32_t	Commits = 0;		// # pages committed
+	FMStorage&	Device;				// the storage device
+
+private:
+	uint Pages() { return Device.Size() / TraceStorePage; }
+	bool Valid(uint page, uint32_t& seq, uint8_t& used, uint8_t& crc, uint8_t& slot);
+
+	uint		Page = 0;			// the index of the current page
+	uint32_t	Seq = 1;			// the sequence # of the current page
+	uint8_t		Used = 0;			// # bytes of records in the current page
+	uint8_t		Crc = 0;			// the CRC of the records in the current page
+	bool		Dirty = false;		// true if records have been appended since the last Commit
+	uint8_t		Stage[PayloadBytes];	// the records of the current page, as staged to be written
+	uint8_t		Written = 0;		// # bytes of records in the current page written to the device
+	bool		HeaderPending = false;	// true if the header of the current page is to be written
+	uint8_t		Header[HeaderBytes];	// the header of the current page being written
+	uint8_t		Slot = 1;			// the slot of the latest header of the current page, written or being written
+	uint8_t		Stale = 0;			// # header slots of the current page left from its last time round, yet to be spoiled
+	uint8_t		HeaderWritten = HeaderBytes;	// # bytes of the Header written to the device
+	uint		ReadPage;			// # pages read during recovery
+	uint8_t		ReadOffset;			// the offset of the next record to read in the page
+	uint8_t		ReadUsed;			// # bytes of records in the page being read
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+
+OOOOOOO OO   OO OOOOO           OOO
+ OO  OO OOO OOO  OO OO           OO
+ OO   O OOOOOOO  OO  OO          OO
+ OO O   OOOOOOO  OO  OO  OOOOO   OOOO   OO  OO   OOO OO
+ OOOO   OO O OO  OO  OO OO   OO  OO OO  OO  OO  OO  OO
+ OO O   OO   OO  OO  OO OOOOOOO  OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO  OO OO       OO  OO OO  OO  OO  OO
+ OO     OO   OO  OO OO  OO   OO  OO  OO OO  OO   OOOOO
+OOOO    OO   OO OOOOO    OOOOO   OOOOO   OOO OO     OO
+                                                OO  OO
+                                                 OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+/*
+Bench for the persistent Trace log on a Linux host, with FMFileStorage standing in for the EEPROM.
+Each trial logs numbered records of varying length to a fresh store, committing every few records, until a simulated
+loss of power partway through a write (FMFileStorage::CrashAfter), then reopens the store as Setup would and reads
+back what's recovered. A trial passes if the records recovered are consecutive and run at least through the last
+record committed before the crash, and no further than the last appended. The write amplification (bytes changed
+on the device per record byte saved) and the wear on the most-written byte, against the mean, are reported too.
+This must be built against a host Arduino core, as FMFileStorage exists only off the device.
+*/
+
+#include <FMDebug.h>
+#include <FMTraceStore.h>
+#include <stdlib.h>
+
+// the bench: the size of the emulated EEPROM, the # trials, and the most records logged in each
+// (each can be overridden at build time, e.g. -DBenchTrials=1000)
+#ifndef BenchDeviceBytes
+#define BenchDeviceBytes 1024
+#endif
+#ifndef BenchTrials
+#define BenchTrials 200
+#endif
+#ifndef BenchRecords
+#define BenchRecords 500
+#endif
+
+const char* Path = "/tmp/TraceStoreBench.bin";
+
+App		app;
+
+uint32_t	Passed = 0;			// # trials whose recovery was correct
+uint32_t	Saved = 0;			// # record bytes appended, over all trials
+uint32_t	Written = 0;		// # bytes changed on the device, over all trials
+uint32_t	MaxWear = 0;		// the most writes to one byte in a trial
+
+/// <summary>Run a trial, logging to a fresh store until the power fails, then recovering the records.</summary>
+/// <param name="crashAfter">The # bytes to write before the power fails.</param>
+/// <returns>True if the records recovered are correct.</returns>
+bool Trial(uint32_t crashAfter)
+{
+	remove(Path);
+	uint32_t durable = 0;			// the last record committed and written whole before the crash
+	uint32_t appended = 0;			// the last record appended
+	{
+		FMFileStorage device(Path, BenchDeviceBytes);
+		FMTraceStore store(device);
+		store.Open();
+		device.CrashAfter = crashAfter;
+		uint8_t record[FMTraceStore::RecordLimit];
+		for (uint32_t i = 1; i <= BenchRecords && device.CrashAfter != 0; ++i)
+		{
+			// a record is its number followed by a few bytes
+			uint len = sizeof(i) + i % 12;
+			memcpy(record, &i, sizeof(i));
+			memset(record + sizeof(i), (uint8_t)i, len - sizeof(i));
+			store.Append(record, len);
+			appended = i;
+			if (rand() % 3 == 0)
+			{
+				store.Commit();
+				// write it out a few bytes at a time, as Run does
+				while (!store.Flush(4))
+					;
+				if (device.CrashAfter != 0)
+					durable = i;
+			}
+		}
+		Saved += store.Saved;
+		Written += device.BytesWritten;
+		if (device.MaxCellWrites() > MaxWear)
+			MaxWear = device.MaxCellWrites();
+	}
+
+	// power up again, and recover the records
+	FMFileStorage device(Path, BenchDeviceBytes);
+	FMTraceStore store(device);
+	store.Open();
+	store.Rewind();
+	uint8_t record[FMTraceStore::RecordLimit];
+	uint32_t last = 0;
+	uint len;
+	while ((len = store.Read(record, sizeof(record))) != 0)
+	{
+		uint32_t i;
+		memcpy(&i, record, sizeof(i));
+		if (len != sizeof(i) + i % 12 || (last != 0 && i != last + 1))
+			return false;
+		last = i;
+	}
+	return last >= durable && last <= appended;
+}
+
+void setup()
+{
+	fmDebug.Init("Trace Store Bench", true);
+	app.AddApplet(&fmDebug);
+	srand(1);
+	for (uint32_t t = 0; t < BenchTrials; ++t)
+	{
+		// fail the power anywhere in about the first 8 passes over the device
+		if (Trial(1 + rand() % (8 * BenchDeviceBytes)))
+			++Passed;
+	}
+	debug.print(F("trials: "), BenchTrials);
+	debug.println(F("  recovered correctly: "), Passed);
+	debug.print(F("write amplification: "), (double)Written / Saved, 2);
+	debug.print(F("  max wear: "), MaxWear);
+	debug.println(F("  mean wear: "), (double)Written / BenchTrials / BenchDeviceBytes, 2);
+	fmDebug.Flush();
+}
+
+void loop()
+{
+	app.Run();
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# TimelineToChrome - convert an FMTimeline dump to Chrome trace-event JSON
+#
+#	(c) 2018 Scott Ferguson
+#	This code is licensed under MIT license (see LICENSE file for details)
+#
+# Capture the debug Serial output of the "-X" command (or the debug output of the Linux simulation)
+# to a file, then:
+#	TimelineToChrome.py capture.txt > timeline.json
+# and open timeline.json in https://ui.perfetto.dev or chrome://tracing.
+# Other lines in the capture are ignored. Each Applet is shown as its own track.
+
+import fileinput
+import json
+import sys
+
+ACTIVITIES = {'R': 'Run', 'I': 'Input', 'O': 'Output'}
+
+def convert(lines):
+	"""Convert the dump lines to a list of trace events."""
+	events = []
+	names = {}
+	inside = False
+	last = None
+	epoch = 0
+	for line in lines:
+		line = line.rstrip('\r\n')
+		if line == '<<<<x':
+			inside = True
+		elif line == '>>>>':
+			inside = False
+		elif inside and line.startswith('N'):
+			prefix, _, name = line[1:].partition(':')
+			names[prefix] = name or prefix
+		elif inside and line:
+			time, kind, prefix = line.split(',', 2)
+			time = int(time)
+			# unwrap the device's 32-bit micros()
+			if last is not None and time + epoch < last:
+				epoch += 1 << 32
+			last = time + epoch
+			name = names.get(prefix, prefix)
+			events.append({
+				'name': ACTIVITIES.get(kind[0], kind[0]),
+				'cat': name,
+				'ph': kind[1],
+				'ts': last,
+				'pid': 1,
+				'tid': '%s (%s)' % (name, prefix),
+			})
+	return events
+
+def main():
+	events = convert(fileinput.input())
+	if events:
+		# start the timeline at zero
+		start = events[0]['ts']
+		for e in events:
+			e['ts'] -= start
+	json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, sys.stdout, indent=1)
+	print()
+
+if __name__ == '__main__':
+	main()
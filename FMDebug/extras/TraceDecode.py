@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+#
+# TraceDecode - decode a binary FMDebug Trace log dump
+#
+#	(c) 2018 Scott Ferguson
+#	This code is licensed under MIT license (see LICENSE file for details)
+#
+# Capture the debug Serial output of the "-b" command to a file, then:
+#	TraceDecode.py capture.txt
+# or pipe the output through it. Other lines in the capture are ignored.
+# Each record is printed as the device's "l" command would print it.
+# The text of each message id is read from the FMMessages table in ../FMMessages.h,
+# which must match the build that made the dump.
+
+import datetime
+import fileinput
+import os
+import re
+import struct
+
+def load_messages():
+	"""Read the message texts, indexed by id, from the FMMESSAGES table."""
+	path = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'FMMessages.h')
+	with open(path) as f:
+		source = f.read()
+	entries = re.findall(r'M\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', source)
+	return [text.encode('latin-1').decode('unicode_escape') for _, text in entries]
+
+def decode_args(kind, data):
+	"""Format the argument bytes of a record by their type."""
+	if kind == 's':
+		return data.decode('latin-1')
+	if kind == 'l':
+		return str(struct.unpack('<i', data)[0])
+	if kind == 'u':
+		return str(struct.unpack('<I', data)[0])
+	if kind == 'f':
+		return '%.3f' % struct.unpack('<f', data)[0]
+	if kind == 'a':
+		prefix, slowest, total = struct.unpack('<cII', data)
+		return '%s %d/%d' % (prefix.decode('latin-1'), slowest, total)
+	return ''
+
+def decode_record(hexbytes, messages):
+	"""Format a "T" record."""
+	b = bytes.fromhex(hexbytes)
+	ms, msg, cat, kind, length = struct.unpack_from('<qBBBB', b)
+	args = b[12:12 + length]
+	t = datetime.datetime(1970, 1, 1) + datetime.timedelta(milliseconds=ms)
+	stamp = t.strftime('%Y/%m/%d %H:%M:%S.') + '%03d' % (ms % 1000)
+	text = messages[msg] if msg < len(messages) else '<%d>' % msg
+	return '[%s] %s%s' % (stamp, text, decode_args(chr(kind) if kind else '', args))
+
+def main():
+	messages = load_messages()
+	inside = False
+	for line in fileinput.input():
+		line = line.rstrip('\r\n')
+		if line == '<<<<b':
+			inside = True
+		elif line == '>>>>':
+			inside = False
+		elif inside and line.startswith('T'):
+			print(decode_record(line[1:], messages))
+
+if __name__ == '__main__':
+	main()
@@ -15,18 +15,45 @@ OOOO    OO   OO   OOOO     OO    OOO OO   OOOO   OOOOO  OO   OO  OOOOO     OOO
  */
 
 #include "FMIvalometer.h"
+#include <FMCounter.h>
+
+FMCounter FramesFired("frames");	// # frames shot by intervalometers
 
  /// <summary>One-time Setup initialization for the Applet.</summary>
 void FMIvalometer::Setup()
 {
-	pinMode(FocusPin, INPUT);
-	pinMode(ShutterPin, INPUT);
+	Controls(INPUT);
+}
+
+/// <summary>Add a camera channel to the intervalometer.</summary>
+/// <param name="focusPin">The output pin used to trigger a focus operation.</param>
+/// <param name="shutterPin">The output pin used to trigger a shutter operation.</param>
+/// <returns>True if the channel was added, false if there is no room or a sequence is active.</returns>
+bool FMIvalometer::AddChannel(uint8_t focusPin, uint8_t shutterPin)
+{
+	if (ChannelCount >= MaxChannels || ShutterAction != Idle)
+		return false;
+	Channel& c = Channels[ChannelCount++];
+	c.FocusPin.Pin = focusPin;
+	c.ShutterPin.Pin = shutterPin;
+#ifdef FMIVAL_PORT_WRITES
+	// look up the port registers once, rather than on every edge
+	c.FocusPin.Reg = portOutputRegister(digitalPinToPort(focusPin));
+	c.FocusPin.Mask = digitalPinToBitMask(focusPin);
+	c.ShutterPin.Reg = portOutputRegister(digitalPinToPort(shutterPin));
+	c.ShutterPin.Mask = digitalPinToBitMask(shutterPin);
+#endif
+	c.Offset = 0;
+	c.FocusDelay = 150;
+	c.ShutterHold = 50;
+	c.Status = Done;
+	return true;
 }
 
 /// <summary>Periodically poll activities for the Applet.</summary>
 void FMIvalometer::Run()
 {
-	// operate the cammera shutter
+	// operate the cammera shutters
 	switch (ShutterAction)
 	{
 	case Idle:		// nothing to do
@@ -36,77 +63,384 @@ void FMIvalometer::Run()
 			uint32_t ms = millis();
 			// set focus and shutter pins as outputs and delay for them to set up
 		//	debug.println("Intervalometer Init: ", ms);
-			pinMode(FocusPin, OUTPUT);
-			digitalWrite(FocusPin, HIGH);
-			pinMode(ShutterPin, OUTPUT);
-			digitalWrite(ShutterPin, HIGH);
-			ShutterTime = ms + 20;				// let the pins settle
-			ShutterAction = Focus;				// next action
+			Controls(OUTPUT);
+			Armed = false;
+			if (Burst)
+			{
+				BurstTime = micros() + Settle;	// let the pins settle, then focus
+				ShutterAction = BurstFocus;		// next action
+			}
+			else
+			{
+				FrameTime = ms + (Settle + 999) / 1000;	// let the pins settle, then start the frame schedule
+				BeginFrame(FrameTime);
+				ShutterAction = Active;			// next action
+				// start any ramp schedule from the beginning
+				if (Segments != 0 && !Single)
+					BeginSegment(0);
+			}
+			// start new timing statistics for a sequence
+			// (single frames add to the statistics of the frames shot before, and have no interval)
+			LastGap = 0;
+			if (!Single)
+			{
+				IntervalError.Clear();
+				HoldError.Clear();
+				LateMax = 0;
+				LateSum = 0;
+				LateFrames = 0;
+			}
 		}
 		break;
-	case Focus:
+	case Active:
+		RunFrame();
+		break;
+	case BurstFocus:
+	case BurstNext:
+	case BurstDone:
+		RunBurst();
+		break;
+	default:
+		break;
+	}
+}
+
+/// <summary>Schedule the focus of every channel for a frame.</summary>
+/// <param name="settled">The earliest time, in ms, the controls have settled for the frame.</param>
+/// <remarks>Each channel is focused at its Offset from the FrameTime, but never before the controls have settled.</remarks>
+void FMIvalometer::BeginFrame(uint32_t settled)
+{
+	for (uint8_t i = 0; i < ChannelCount; ++i)
+	{
+		Channel& c = Channels[i];
+		c.EdgeTime = FrameTime + c.Offset;
+		if ((int32_t)(c.EdgeTime - settled) < 0)
+			c.EdgeTime = settled;
+		c.Status = Waiting;
+	}
+}
+
+/// <summary>Poll the activities of a frame.</summary>
+/// <remarks>
+/// The edges of every channel due in this poll are written together, and the next frame is
+/// scheduled once every channel has released its controls.
+/// </remarks>
+void FMIvalometer::RunFrame()
+{
+	uint32_t ms = millis();
+	ChannelStatus first = Channels[0].Status;
+	bool done = true;
+	for (uint8_t i = 0; i < ChannelCount; ++i)
+	{
+		Channel& c = Channels[i];
+		if (c.Status != Done && (int32_t)(ms - c.EdgeTime) >= 0)	// wait (safely across a millis() wrap)
 		{
-			uint32_t ms = millis();
-			if (ms >= ShutterTime)				// wait
+			switch (c.Status)
 			{
+			case Waiting:
+				{
+					// record how late the focus is against the schedule
+					uint32_t late = ms - (FrameTime + c.Offset);
+					if (LateFrames == 0 || late < LateMin)
+						LateMin = late;
+					if (late > LateMax)
+						LateMax = late;
+					LateSum += late;
+					++LateFrames;
+				}
 				// the focus must be triggered and held for some duration
 				// before the shutter is triggered, and then both are held until finished
-			//	debug.println("Intervalometer Focus: ", ms);
-				digitalWrite(FocusPin, LOW);	// ground focus pin to activate
-				ShutterTime = ms + FocusDelay;	// delay for camera to focus
-				ShutterAction = Shutter;		// next action
+				Edge(c.FocusPin, LOW);			// ground focus pin to activate
+				c.EdgeTime = ms + c.FocusDelay;	// delay for camera to focus
+				c.Status = Focus;
+				break;
+			case Focus:
+				Edge(c.ShutterPin, LOW);		// ground shutter pin to activate
+				++FramesFired;
+				c.EdgeTime = ms + c.ShutterHold;// delay for camera action
+				c.Status = Shutter;
+				break;
+			case Shutter:
+				Edge(c.FocusPin, HIGH);			// set controls to untriggered state
+				Edge(c.ShutterPin, HIGH);
+				c.Status = Done;
+				break;
+			default:
+				break;
+			}
+		}
+		if (c.Status != Done)
+			done = false;
+	}
+	Flush();								// write all the edges due in this poll together
+	if (Stamping && Channels[0].Status != first)
+	{
+		// stamp the edge of the first channel
+		uint32_t us = micros();
+		if (Channels[0].Status == Focus)
+			Stamp.Focus = us;
+		else if (Channels[0].Status == Shutter)
+			Stamp.Shutter = us;
+		else
+			LogFrame(us, Channels[0].ShutterHold * 1000UL);
+	}
+	if (!done)
+		return;
+	// every channel has completed this frame
+	if (Single)
+	{
+		// a single frame is done - leave the controls set up for the next one
+		Single = false;
+		Armed = true;
+		SettledTime = ms + (Settle + 999) / 1000;
+		ShutterAction = Idle;			// next action
+	}
+	else if (Frames == 0 || --Frames == 0)
+	{
+		// number of frames complete - Intervalometer sequence done!
+		SendProp(Prop_Frames);			// notify controller
+	//	debug.println("Intervalometer Done: ", ms);
+		Controls(INPUT);				// reset controls to inactive state
+		ShutterAction = Idle;			// next action
+	}
+	else
+	{
+		// one more frame complete
+		SendProp(Prop_Frames);			// notify controller
+	//	debug.println("Intervalometer Frames: ", Frames);
+		// the next frame is scheduled an Interval after this one was, regardless of when this one
+		// actually happened, but we must still allow at least time for controls to settle
+		uint32_t gap = NextInterval();
+		FrameTime += gap;
+		LastGap = gap * 1000;
+		BeginFrame(ms + (Settle + 999) / 1000);
+	}
+}
+
+/// <summary>Poll the activities of a burst.</summary>
+/// <remarks>
+/// The focus of every channel is triggered once and held for the whole burst, and the shutters are then triggered
+/// together for each frame on the schedule kept by BurstTimer, but never until the controls have settled.
+/// The channel Offsets don't apply to a burst, and the first frame waits for the longest FocusDelay.
+/// The App's Run is claimed only as the next edge comes within FMIVAL_BURST_CLAIM, so nothing else delays the edge,
+/// and released once it's written. The burst still runs if the claim fails.
+/// </remarks>
+void FMIvalometer::RunBurst()
+{
+	uint32_t us = micros();
+	switch (ShutterAction)
+	{
+	case BurstFocus:
+		if ((int32_t)(us - BurstTime) >= 0)	// wait (safely across a micros() wrap)
+		{
+			uint focusDelay = 0;
+			for (uint8_t i = 0; i < ChannelCount; ++i)
+			{
+				Edge(Channels[i].FocusPin, LOW);	// ground focus pin to activate
+				if (Channels[i].FocusDelay > focusDelay)
+					focusDelay = Channels[i].FocusDelay;
 			}
+			Flush();
+			if (Stamping)
+				Stamp.Focus = us;
+			// the first frame is shot after the cameras have focused, and the rest every BurstInterval after that
+			BurstTimer.PeriodMicroS = BurstInterval;
+			BurstTimer.RestartAt(us + focusDelay * 1000UL);
+			BurstTime = us;
+			ShutterAction = BurstNext;		// next action
 		}
 		break;
-	case Shutter:
+	case BurstNext:
+		if ((int32_t)(us - BurstTime) >= 0 && BurstTimer.Next())	// wait to settle, then for the schedule
 		{
-			uint32_t ms = millis();
-			if (ms >= ShutterTime)				// wait
+			for (uint8_t i = 0; i < ChannelCount; ++i)
 			{
-				// the shutter is triggered after the focus is established,
-				// and then both are held until finished
-			//	debug.println("Intervalometer Shutter: ", ms);
-				digitalWrite(ShutterPin, LOW);	// ground shutter pin to activate
-				ShutterTime = ms + ShutterHold;	// delay for camera action
-				ShutterAction = Done;			// next action
+				Edge(Channels[i].ShutterPin, LOW);	// ground shutter pin to activate
+				++FramesFired;
 			}
+			Flush();
+			if (Stamping)
+				Stamp.Shutter = us;
+			BurstTime = us + BurstHold;		// delay for camera action
+			ShutterAction = BurstDone;		// next action
 		}
 		break;
-	case Done:
+	case BurstDone:
+		if ((int32_t)(us - BurstTime) >= 0)	// wait
 		{
-			uint32_t ms = millis();
-			if (ms >= ShutterTime)					// wait
+			for (uint8_t i = 0; i < ChannelCount; ++i)
+				Edge(Channels[i].ShutterPin, HIGH);	// set shutter control to untriggered state
+			Flush();
+			if (Stamping)
+				LogFrame(us, BurstHold);
+			LastGap = BurstInterval;
+			if (Frames == 0 || --Frames == 0)
 			{
-				// this focus/shutter cycle is complete
-				if (Frames == 0 || --Frames == 0)
-				{
-					// number of frames complete - Intervalometer sequence done!
-					SendProp(Prop_Frames);			// notify controller
-				//	debug.println("Intervalometer Done: ", ms);
-					pinMode(FocusPin, INPUT);		// reset controls to inactive state
-					pinMode(ShutterPin, INPUT);
-					ShutterAction = Idle;			// next action
-				}
-				else
-				{
-					// one more frame complete
-					SendProp(Prop_Frames);			// notify controller
-				//	debug.println("Intervalometer Frames: ", Frames);
-					digitalWrite(FocusPin, HIGH);	// set controls to untriggered state
-					digitalWrite(ShutterPin, HIGH);
-					// delay for specified interval, or at least time for controls to settle
-					if (Interval >= FocusDelay + ShutterHold)
-						ShutterTime = ms + Interval - (FocusDelay + ShutterHold);
-					else
-						ShutterTime = ms + 20;
-					ShutterAction = Focus;			// next action
-				}
+				// number of frames complete - burst done!
+				Stop();						// reset controls to inactive state
+				SendProp(Prop_BurstFrames);	// notify controller
+				return;
+			}
+			else
+			{
+				BurstTime = us + Settle;	// let the shutter control settle
+				ShutterAction = BurstNext;	// next action
 			}
 		}
 		break;
 	default:
 		break;
 	}
+	// hold the App's Run only while the next edge is close, so the other Applets still Run between edges
+	uint32_t due = BurstTime;
+	if (ShutterAction == BurstNext && (int32_t)(BurstTimer.Due() - due) > 0)
+		due = BurstTimer.Due();
+	if ((int32_t)(due - micros()) < (int32_t)FMIVAL_BURST_CLAIM)
+		Parent->Claim(this);
+	else
+		Parent->Release(this);
+}
+
+/// <summary>Stop any trigger sequence or burst, releasing the controls and any claim on the App's Run.</summary>
+void FMIvalometer::Stop()
+{
+	Controls(INPUT);
+	Parent->Release(this);
+	Burst = false;
+	Single = false;
+	Armed = false;
+	ShutterAction = Idle;
+}
+
+/// <summary>Set the control pins of every channel to their released state.</summary>
+/// <param name="mode">OUTPUT to drive the pins high, or INPUT to leave them inactive.</param>
+void FMIvalometer::Controls(uint8_t mode)
+{
+	for (uint8_t i = 0; i < ChannelCount; ++i)
+	{
+		Channel& c = Channels[i];
+		pinMode(c.FocusPin.Pin, mode);
+		pinMode(c.ShutterPin.Pin, mode);
+		if (mode == OUTPUT)
+		{
+			digitalWrite(c.FocusPin.Pin, HIGH);
+			digitalWrite(c.ShutterPin.Pin, HIGH);
+		}
+		c.Status = Done;
+	}
+}
+
+/// <summary>Collect a pin edge to be written by Flush.</summary>
+/// <param name="pin">The pin.</param>
+/// <param name="level">The new level for the pin.</param>
+/// <remarks>Without port register writes, the edge is written immediately.</remarks>
+void FMIvalometer::Edge(const PinOut& pin, uint8_t level)
+{
+#ifdef FMIVAL_PORT_WRITES
+	uint8_t i = 0;
+	while (i < PortCount && Ports[i].Reg != pin.Reg)
+		++i;
+	if (i == PortCount)
+	{
+		Ports[i].Reg = pin.Reg;
+		Ports[i].Set = 0;
+		Ports[i].Clear = 0;
+		++PortCount;
+	}
+	if (level == LOW)
+		Ports[i].Clear |= pin.Mask;
+	else
+		Ports[i].Set |= pin.Mask;
+#else
+	digitalWrite(pin.Pin, level);
+#endif
+}
+
+/// <summary>Write the edges collected in this poll, with one write to each port.</summary>
+void FMIvalometer::Flush()
+{
+#ifdef FMIVAL_PORT_WRITES
+	if (PortCount == 0)
+		return;
+	// the read-modify-write of each port must not be interrupted by anything else writing the port
+	noInterrupts();
+	for (uint8_t i = 0; i < PortCount; ++i)
+		*Ports[i].Reg = (*Ports[i].Reg | Ports[i].Set) & ~Ports[i].Clear;
+	interrupts();
+	PortCount = 0;
+#endif
+}
+
+/// <summary>Shoot a single frame, outside of any sequence set through the Frames property.</summary>
+/// <returns>True if the frame was started, false if a trigger sequence is already active.</returns>
+/// <remarks>
+/// This allows another Applet to control the timing of frames. Use Busy() to determine when the frame is done.
+/// The Frames property is not reported to the controller for a single frame.
+/// The controls are left set up after the frame, so the next one is shot without setting them up and waiting
+/// for them to settle again. Call Disarm() to release them once done shooting.
+/// </remarks>
+bool FMIvalometer::Shoot()
+{
+	if (ShutterAction != Idle || ChannelCount == 0)
+		return false;
+	Frames = 1;
+	Single = true;
+	if (Armed)
+	{
+		// the controls are still set up from the last frame, so just schedule this one
+		LastGap = 0;
+		FrameTime = millis();
+		BeginFrame(SettledTime);
+		ShutterAction = Active;
+	}
+	else
+	{
+		ShutterAction = Init;
+	}
+	return true;
+}
+
+/// <summary>Release the controls left set up by Shoot(), stopping any frame it's shooting.</summary>
+/// <remarks>A sequence or burst started through the properties is left alone.</remarks>
+void FMIvalometer::Disarm()
+{
+	if (Single || (Armed && ShutterAction == Idle))
+		Stop();
+}
+
+/// <summary>Set a property value for one or all channels.</summary>
+/// <param name="field">The channel field to set.</param>
+/// <param name="v">The value to set, as "channel,value" or just "value" for all channels.</param>
+/// <returns>True if the value was set, false if the channel is invalid.</returns>
+bool FMIvalometer::SetChannelProp(uint Channel::* field, const String& v)
+{
+	int comma = v.indexOf(',');
+	if (comma < 0)
+	{
+		for (uint8_t i = 0; i < ChannelCount; ++i)
+			Channels[i].*field = v.toInt();
+		return true;
+	}
+	int channel = v.substring(0, comma).toInt();
+	if (channel < 0 || channel >= ChannelCount)
+		return false;
+	Channels[channel].*field = v.substring(comma + 1).toInt();
+	return true;
+}
+
+/// <summary>Get a property value for all channels.</summary>
+/// <param name="field">The channel field to get.</param>
+/// <returns>The values for each channel, in the order added, separated by commas.</returns>
+String FMIvalometer::GetChannelProp(uint Channel::* field)
+{
+	String s;
+	for (uint8_t i = 0; i < ChannelCount; ++i)
+	{
+		if (i != 0)
+			s += ',';
+		s += String(Channels[i].*field);
+	}
+	return s;
 }
 
 /// <summary>Set a property value.</summary>
@@ -117,17 +451,49 @@ bool FMIvalometer::SetProp(char prop, const String& v)
 	switch (prop)
 	{
 	case Prop_FocusDelay:
-		FocusDelay = v.toInt();
-		break;
+		return SetChannelProp(&Channel::FocusDelay, v);
 	case Prop_ShutterHold:
-		ShutterHold = v.toInt();
-		break;
+		return SetChannelProp(&Channel::ShutterHold, v);
+	case Prop_Offset:
+		return SetChannelProp(&Channel::Offset, v);
 	case Prop_Interval:
 		Interval = v.toInt();
 		break;
+	case Prop_Ramp:
+		return SetRamp(v);
+	case Prop_Settle:
+		Settle = v.toInt();
+		break;
+	case Prop_BurstInterval:
+		BurstInterval = v.toInt();
+		break;
+	case Prop_BurstHold:
+		BurstHold = v.toInt();
+		break;
+	case Prop_BurstFrames:
+		if (v.toInt() == 0 && Burst)
+		{
+			// abort the burst, releasing the controls
+			Stop();
+		}
+		else if (BurstInterval > 0 && v.toInt() > 0 && ChannelCount != 0 && ShutterAction == Idle)
+		{
+			// setting the #burst frames starts a burst
+			Frames = v.toInt();
+			Burst = true;
+			ShutterAction = Init;
+		}
+		break;
 	case Prop_Frames:
+		if (Burst)
+			return false;				// the frames of a burst are set through BurstFrames
 		Frames = v.toInt();
-		if (Interval > 0 && Frames > 0 && ShutterAction == Idle)
+		if (Frames == 0 && ShutterAction != Idle)
+		{
+			// stop the sequence, releasing the controls
+			Stop();
+		}
+		else if ((Interval > 0 || Segments != 0) && Frames > 0 && ChannelCount != 0 && ShutterAction == Idle)
 		{
 			// setting the #frames starts intervalometer function
 			ShutterAction = Init;
@@ -146,14 +512,251 @@ String FMIvalometer::GetProp(char prop)
 	switch (prop)
 	{
 	case Prop_FocusDelay:
-		return String(FocusDelay);
+		return GetChannelProp(&Channel::FocusDelay);
 	case Prop_ShutterHold:
-		return String(ShutterHold);
+		return GetChannelProp(&Channel::ShutterHold);
+	case Prop_Offset:
+		return GetChannelProp(&Channel::Offset);
+	case Prop_Channels:
+		return String(ChannelCount);
 	case Prop_Interval:
 		return String(Interval);
 	case Prop_Frames:
 		return String(Frames);
+	case Prop_Settle:
+		return String(Settle);
+	case Prop_BurstFrames:
+		return String(Burst ? Frames : 0);
+	case Prop_BurstInterval:
+		return String(BurstInterval);
+	case Prop_BurstHold:
+		return String(BurstHold);
+	case Prop_LateMin:
+		return String(LateFrames == 0 ? 0 : LateMin);
+	case Prop_LateMax:
+		return String(LateMax);
+	case Prop_LateMean:
+		return String(LateFrames == 0 ? 0.0 : (double)LateSum / LateFrames);
+	case Prop_Segment:
+		return String(Segment);
+	case Prop_Stamp:
+		return StampCount == 0 ? String("0,0,0") : Stamps[(StampHead + StampFrames - 1) % StampFrames].ToString();
+	case Prop_IntervalError:
+		return IntervalError.ToString();
+	case Prop_HoldError:
+		return HoldError.ToString();
+	case Prop_Ramp:
+		{
+			String s = Segments == 0 ? "0" : "";
+			for (uint8_t i = 0; i < Segments; ++i)
+			{
+				if (i != 0)
+					s += '/';
+				s += String(Ramp[i].Frames) + "," + String(Ramp[i].Start) + "," + String(Ramp[i].End) + "," + Ramp[i].Curve;
+			}
+			return s;
+		}
 	default:
 		return (String)NULL;
 	}
 }
+
+/// <summary>Get the properties sent to the controller as a snapshot of the Applet's state.</summary>
+/// <returns>The null-terminated list of property character codes.</returns>
+/// <remarks>
+/// The settings and progress of the shooting, with the per-channel settings as comma lists, but not the timing statistics,
+/// which the controller asks for as it needs them.
+/// </remarks>
+const char* FMIvalometer::SnapshotProps()
+{
+	static const char props[] = { Prop_Interval, Prop_Frames, Prop_Channels, Prop_Offset, Prop_FocusDelay, Prop_ShutterHold, Prop_Settle, Prop_BurstFrames, Prop_Segment, '\0' };
+	return props;
+}
+
+/// <summary>Process a Command string.</summary>
+/// <param name="s">The Command string.</param>
+/// <remarks>
+/// The first character determines the action:
+///		't' - Toggle the Stamping setting, which records frame timestamps and timing error statistics.
+///		'l' - Dump the frame timestamps and timing error statistics to the debug output.
+///		'o' - Stream the frame timestamps and timing error statistics to the controller, as Stamp properties
+///			  (oldest first) followed by the IntervalError and HoldError properties.
+/// </remarks>
+void FMIvalometer::Command(const String& s)
+{
+	switch (s[0])
+	{
+	case 't':
+		// Toggle the Stamping setting
+		Stamping = !Stamping;
+		break;
+	case 'l':
+		// Dump the frame timestamps and statistics
+		debug.println(F("<<<<"));
+		for (uint8_t i = 0; i < StampCount; ++i)
+			debug.println(Stamps[(StampHead + StampFrames - StampCount + i) % StampFrames].ToString());
+		debug.println(F("interval error: "), IntervalError.ToString());
+		debug.println(F("hold error: "), HoldError.ToString());
+		debug.println(F(">>>>"));
+		break;
+	case 'o':
+		// Stream the frame timestamps and statistics, stopping if the output refuses them
+		for (uint8_t i = 0; i < StampCount && Parent->Linked(); ++i)
+		{
+			if (!Parent->Output(String(Prefix) + "=" + (char)Prop_Stamp + Stamps[(StampHead + StampFrames - StampCount + i) % StampFrames].ToString()))
+			{
+				FMLOG_WARN(FMLOG_CAT_CAMERA, "stamps refused: ", StampCount - i);
+				break;
+			}
+		}
+		SendProp(Prop_IntervalError);
+		SendProp(Prop_HoldError);
+		break;
+	default:
+		FMLOG_WARN(FMLOG_CAT_CAMERA, "invalid FMIvalometer input: ", s[0]);
+		break;
+	}
+}
+
+/// <summary>Record the timestamps of a completed frame, and its timing errors.</summary>
+/// <param name="release">The time, in microseconds, the controls are being released.</param>
+/// <param name="hold">The time, in microseconds, the shutter was to be held.</param>
+void FMIvalometer::LogFrame(uint32_t release, uint32_t hold)
+{
+	Stamp.Release = release;
+	// the interval error is only known if there was a previous frame in this sequence
+	if (LastGap != 0)
+		IntervalError.Add((int32_t)(Stamp.Shutter - PrevShutter) - (int32_t)LastGap);
+	HoldError.Add((int32_t)(Stamp.Release - Stamp.Shutter) - (int32_t)hold);
+	PrevShutter = Stamp.Shutter;
+	// add to the ring, overwriting the oldest
+	Stamps[StampHead] = Stamp;
+	if (++StampHead >= StampFrames)
+		StampHead = 0;
+	if (StampCount < StampFrames)
+		++StampCount;
+}
+
+/// <summary>Add an error to the statistics.</summary>
+/// <param name="err">The error, in microseconds.</param>
+void FMIvalometer::ErrorStats::Add(int32_t err)
+{
+	if (Count == 0 || err < Min)
+		Min = err;
+	if (Count == 0 || err > Max)
+		Max = err;
+	Sum += err;
+	++Count;
+}
+
+/// <summary>Format the statistics as a string.</summary>
+/// <returns>The statistics, in microseconds, as "min,max,mean".</returns>
+String FMIvalometer::ErrorStats::ToString()
+{
+	return String(Min) + "," + String(Max) + "," + String(Count == 0 ? 0 : (long)(Sum / Count));
+}
+
+/// <summary>Set the interval ramp schedule.</summary>
+/// <param name="v">The schedule, as segments separated by '/', each as "frames,start,end,curve".</param>
+/// <returns>True if the schedule was valid and set; otherwise false, and the schedule is cleared.</returns>
+/// <remarks>Setting "0" clears the schedule, so the fixed Interval is used.</remarks>
+bool FMIvalometer::SetRamp(const String& v)
+{
+	Segments = 0;
+	if (v == "0")
+		return true;
+	int start = 0;
+	while (start < (int)v.length())
+	{
+		if (Segments >= MaxSegments)
+		{
+			Segments = 0;
+			return false;
+		}
+		// parse the four comma-separated fields of the segment
+		int end = v.indexOf('/', start);
+		if (end == -1)
+			end = v.length();
+		int c1 = v.indexOf(',', start);
+		int c2 = c1 == -1 ? -1 : v.indexOf(',', c1 + 1);
+		int c3 = c2 == -1 ? -1 : v.indexOf(',', c2 + 1);
+		if (c3 == -1 || c3 + 1 >= end)
+		{
+			Segments = 0;
+			return false;
+		}
+		RampSegment& seg = Ramp[Segments];
+		seg.Frames = v.substring(start, c1).toInt();
+		seg.Start = v.substring(c1 + 1, c2).toInt();
+		seg.End = v.substring(c2 + 1, c3).toInt();
+		seg.Curve = v[c3 + 1];
+		if (seg.Frames == 0 || seg.Start == 0 || seg.End == 0 || (seg.Curve != Linear && seg.Curve != Exponential))
+		{
+			Segments = 0;
+			return false;
+		}
+		++Segments;
+		start = end + 1;
+	}
+	return Segments != 0;
+}
+
+/// <summary>Begin a segment of the ramp schedule.</summary>
+/// <param name="segment">The index of the segment.</param>
+/// <remarks>
+/// The per-frame change in interval is computed once here, so that each frame needs only one add or multiply.
+/// The controller is notified of the new segment and interval.
+/// </remarks>
+void FMIvalometer::BeginSegment(uint8_t segment)
+{
+	const RampSegment& seg = Ramp[segment];
+	Segment = segment;
+	SegmentFrames = seg.Frames;
+	RampInterval = seg.Start;
+	RampCarry = 0;
+	if (seg.Frames <= 1)
+		RampStep = seg.Curve == Exponential ? 1 : 0;
+	else if (seg.Curve == Exponential)
+		RampStep = pow((double)seg.End / seg.Start, 1.0 / (seg.Frames - 1));
+	else
+		RampStep = ((float)seg.End - (float)seg.Start) / (seg.Frames - 1);
+	Interval = seg.Start;
+	SendProp(Prop_Segment);		// notify controller
+	SendProp(Prop_Interval);
+}
+
+/// <summary>Get the interval to the next frame, advancing through any ramp schedule.</summary>
+/// <returns>The interval, in ms.</returns>
+uint32_t FMIvalometer::NextInterval()
+{
+	if (Segments == 0 || Single)
+		return Interval;
+	// carry fractions of a ms from frame to frame so the ramp doesn't drift
+	RampCarry += RampInterval;
+	uint32_t interval = (uint32_t)RampCarry;
+	RampCarry -= interval;
+	// advance the ramp for the next frame
+	if (SegmentFrames > 1)
+	{
+		--SegmentFrames;
+		if (Ramp[Segment].Curve == Exponential)
+			RampInterval *= RampStep;
+		else
+			RampInterval += RampStep;
+		Interval = (uint32_t)(RampInterval + 0.5);
+	}
+	else if (Segment + 1 < Segments)
+	{
+		float carry = RampCarry;
+		BeginSegment(Segment + 1);
+		RampCarry = carry;
+	}
+	else
+	{
+		// the schedule is done, so stay at the last interval
+		SegmentFrames = 0;
+		RampInterval = Ramp[Segment].End;
+		Interval = Ramp[Segment].End;
+	}
+	return interval;
+}
@@ -25,24 +25,91 @@ OOOO    OO   OO   OOOO     OO    OOO OO   OOOO   OOOOO  OO   OO  OOOOO     OOO
 
 #include <FMDebug.h>
 #include <Applet.h>
+#include <Metronome.h>
 
+// pin edges can be batched into port register writes on these architectures
+#if defined(__AVR__)
+#define FMIVAL_PORT_WRITES
+typedef volatile uint8_t	PortRegister;
+typedef uint8_t				PortMask;
+#elif defined(ARDUINO_ARCH_SAMD)
+#define FMIVAL_PORT_WRITES
+typedef volatile uint32_t	PortRegister;
+typedef uint32_t			PortMask;
+#endif
+
+// the maximum number of cameras an intervalometer can trigger
+#ifndef FMIVAL_CHANNELS
+#define FMIVAL_CHANNELS 4
+#endif
+
+// in us - how long before each burst edge the intervalometer claims exclusive use of the App's Run
+#ifndef FMIVAL_BURST_CLAIM
+#define FMIVAL_BURST_CLAIM 2000
+#endif
+
+/// <summary>An Applet implementing an intervalometer for triggering the focus and shutter of one or more cameras.</summary>
+/// <remarks>
+/// Frames are scheduled on an absolute timeline: frame N is focused at N Intervals after the first,
+/// so delays in polling the Applet don't accumulate from frame to frame over a long sequence.
+/// The lateness of each focus against that schedule is recorded, and reported as min/max/mean statistics.
+/// The Interval may be fixed, or may follow a ramp schedule uploaded as the Ramp property. The schedule is a list
+/// of segments, each a number of frames over which the interval moves from a start to an end value on a linear or
+/// exponential curve. The Ramp is uploaded as segments separated by '/', each as "frames,start,end,curve",
+/// where the curve is 'l' (linear) or 'e' (exponential), e.g. "100,5000,5000,l/300,5000,30000,e".
+/// The interval for each frame is computed incrementally as the sequence progresses, and the last end value
+/// continues to be used once the schedule is done. Setting the Ramp to "0" clears it.
+/// Progress through the schedule is reported with the Segment and Interval properties as each segment begins.
+/// Each channel drives the focus and shutter pins of one camera. Every channel shares the one timeline, so they
+/// can't drift apart, and each is focused at its own Offset from the frame time, then triggered and held with its
+/// own FocusDelay and ShutterHold. The pin edges due in a poll are collected and, where the architecture allows,
+/// written together with a single write to each port register, so that edges on pins sharing a port happen at
+/// exactly the same time. The next frame begins once every channel has completed the current one.
+/// The per-channel properties are read as a list of values, one per channel in the order added, e.g. "0,250,500".
+/// They are set for one channel as "channel,value", or for all channels as a single value.
+/// When Stamping is on, the times in microseconds of the focus, shutter and release edges of the first channel
+/// for the most recent frames are kept in a small ring, and feed statistics of the error in the interval between
+/// shutter edges and in the shutter hold time. The Stamp property is the latest of them, or "0,0,0" if there are none.
+/// When Stamping is off, this costs no more than a test at each poll.
+/// Setting BurstFrames starts a burst: the focus of every channel is held throughout, and the shutters are triggered
+/// together for BurstHold every BurstInterval, on a microsecond schedule kept by a Micronome. For FMIVAL_BURST_CLAIM
+/// microseconds before each burst edge the Applet claims exclusive use of the App's Run, so no other Applet can delay
+/// the edge, and it releases the claim once the edge is written, so the communications Applets are still polled
+/// between edges. Frames are reported only at the end of a burst. The Settle time allowed for the controls before
+/// the first frame and between frames is also in microseconds.
+/// Setting Frames to zero stops a sequence, and setting BurstFrames to zero aborts a burst.
+/// </remarks>
 class FMIvalometer : public Applet
 {
 public:
-	/// <summary>Constructor.</summary>
+	/// <summary>The maximum number of channels that can be triggered.</summary>
+	static const uint8_t MaxChannels = FMIVAL_CHANNELS;
+
+	/// <summary>Constructor for an intervalometer triggering one camera.</summary>
 	/// <param name="prefix">The character code to associate with this Applet.</param>
 	/// <param name="focusPin">The output pin used to trigger a focus operation.</param>
 	/// <param name="shutterPin">The output pin used to trigger a shutter operation.</param>
-	FMIvalometer(char prefix, uint8_t focusPin, uint8_t shutterPin) : Applet(prefix)
+	FMIvalometer(char prefix, uint8_t focusPin, uint8_t shutterPin) : Applet(prefix), BurstTimer(200000)
 	{
-		FocusPin = focusPin;
-		ShutterPin = shutterPin;
+		AddChannel(focusPin, shutterPin);
 	}
 
+	/// <summary>Constructor for an intervalometer whose cameras are added with AddChannel.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	FMIvalometer(char prefix) : Applet(prefix), BurstTimer(200000) { }
+
 	void		Setup();
 	void		Run();
 	bool		SetProp(char prop, const String& v);
 	String		GetProp(char prop);
+	const char*	SnapshotProps();
+	void		Command(const String& s);
+
+	bool		AddChannel(uint8_t focusPin, uint8_t shutterPin);
+	bool		Shoot();
+	void		Disarm();
+	/// <summary>Determine if a trigger sequence is active.</summary>
+	bool		Busy() { return ShutterAction != Idle; }
 
 	/// <summary>Properties exposed to the communications interface.</summary>
 	/// <remarks>The enum values represent the character codes used in the Input/Output strings.</remarks>
@@ -52,27 +119,177 @@ public:
 		Prop_ShutterHold = 's',
 		Prop_Interval = 'i',
 		Prop_Frames = 'f',
+		Prop_Channels = 'c',
+		Prop_Offset = 'o',
+		Prop_LateMin = 'n',
+		Prop_LateMax = 'x',
+		Prop_LateMean = 'm',
+		Prop_Ramp = 'r',
+		Prop_Segment = 'g',
+		Prop_Stamp = 't',
+		Prop_IntervalError = 'j',
+		Prop_HoldError = 'h',
+		Prop_Settle = 'w',
+		Prop_BurstFrames = 'b',
+		Prop_BurstInterval = 'u',
+		Prop_BurstHold = 'p',
+	};
+
+	/// <summary>The curve followed by the interval over a ramp segment.</summary>
+	enum RampCurve
+	{
+		Linear = 'l',		// the interval changes by the same amount each frame
+		Exponential = 'e'	// the interval changes by the same ratio each frame
+	};
+
+	/// <summary>A segment of an interval ramp schedule.</summary>
+	struct RampSegment
+	{
+		uint		Frames;		// # frames in the segment
+		uint32_t	Start;		// in ms - interval following the first frame
+		uint32_t	End;		// in ms - interval following the last frame
+		char		Curve;		// the RampCurve followed from Start to End
+	};
+
+	/// <summary>The maximum number of segments in a ramp schedule.</summary>
+	static const uint8_t MaxSegments = 8;
+
+	/// <summary>The times of the control edges of a frame.</summary>
+	struct FrameStamp
+	{
+		uint32_t	Focus;		// in us - time the focus was triggered
+		uint32_t	Shutter;	// in us - time the shutter was triggered
+		uint32_t	Release;	// in us - time the controls were released
+		String		ToString() { return String(Focus) + "," + String(Shutter) + "," + String(Release); }
+	};
+
+	/// <summary>Running statistics of a timing error.</summary>
+	struct ErrorStats
+	{
+		int32_t		Min;		// in us - least error
+		int32_t		Max;		// in us - greatest error
+		float		Sum;		// in us - total error
+		uint		Count;		// # errors
+		void		Clear() { Min = Max = 0; Sum = 0; Count = 0; }
+		void		Add(int32_t err);
+		String		ToString();
 	};
 
+	/// <summary>The number of frames kept in the ring of frame timestamps.</summary>
+	static const uint8_t StampFrames = 8;
+
+	bool		Stamping = false;		// Set to true to record frame timestamps and timing error statistics
+
 private:
 	/// <summary>The state of a shutter trigger sequence.</summary>
 	enum ShutterStatus
 	{
 		Idle,		// no trigger sequence active
 		Init,		// shutter and focus controls initialized
+		Active,		// frames being shot
+		BurstFocus,	// burst controls initialized
+		BurstNext,	// focus controls triggered, waiting for the next burst frame
+		BurstDone	// shutter controls triggered for a burst frame
+	};
+
+	/// <summary>The state of a channel within a frame.</summary>
+	enum ChannelStatus
+	{
+		Waiting,	// waiting to trigger the focus
 		Focus,		// focus control triggered
 		Shutter,	// shutter control triggered
 		Done		// controls released
 	};
 
-	uint8_t		FocusPin;				// the output pin used to trigger a focus operation
-	uint8_t		ShutterPin;				// the output pin used to trigger a shutter operation
+	/// <summary>An output pin, with its port register and bit mask where edges are batched.</summary>
+	struct PinOut
+	{
+		uint8_t		Pin;		// the output pin
+#ifdef FMIVAL_PORT_WRITES
+		PortRegister* Reg;		// the pin's port output register
+		PortMask	Mask;		// the pin's bit within the port
+#endif
+	};
+
+	/// <summary>A camera triggered by the intervalometer.</summary>
+	struct Channel
+	{
+		PinOut		FocusPin;			// the output pin used to trigger a focus operation
+		PinOut		ShutterPin;			// the output pin used to trigger a shutter operation
+		uint		Offset;				// in ms - delay from the frame time to focus
+		uint		FocusDelay;			// in ms - delay after focus before tripping shutter
+		uint		ShutterHold;		// in ms - time to hold shutter signal
+		ChannelStatus Status;			// next action to take in this frame
+		uint32_t	EdgeTime;			// in ms - time for the next action
+	};
+
+#ifdef FMIVAL_PORT_WRITES
+	/// <summary>The edges collected for one port in a poll.</summary>
+	struct PortEdges
+	{
+		PortRegister* Reg;		// the port output register
+		PortMask	Set;		// bits to be set high
+		PortMask	Clear;		// bits to be set low
+	};
+#endif
+
+	void		Edge(const PinOut& pin, uint8_t level);
+	void		Flush();
+	void		Controls(uint8_t mode);
+	void		Stop();
+	void		BeginFrame(uint32_t settled);
+	void		RunFrame();
+	void		RunBurst();
+	bool		SetChannelProp(uint Channel::* field, const String& v);
+	String		GetChannelProp(uint Channel::* field);
+	bool		SetRamp(const String& v);
+	void		BeginSegment(uint8_t segment);
+	uint32_t	NextInterval();
+	void		LogFrame(uint32_t release, uint32_t hold);
+
+	Channel		Channels[MaxChannels];	// the cameras triggered
+	uint8_t		ChannelCount = 0;		// # channels added
+#ifdef FMIVAL_PORT_WRITES
+	PortEdges	Ports[MaxChannels * 2];	// the edges collected in the current poll
+	uint8_t		PortCount = 0;			// # ports with edges collected
+#endif
+
 	ShutterStatus ShutterAction = Idle;	// next shutter action to take
-	uint32_t	ShutterTime;			// in ms - time for next shutter/focus action
-	uint		FocusDelay = 150;		// in ms - delay after focus before tripping shutter
-	uint		ShutterHold = 50;		// in ms - time to hold shutter signal
-	uint		Interval = 0;			// in ms - time between camera frames
+	uint32_t	FrameTime;				// in ms - scheduled time of the current frame
+	uint32_t	Interval = 0;			// in ms - time between camera frames
 	uint		Frames = 0;				// # frames remaining to shoot
+	bool		Single = false;			// true if shooting a single frame for Shoot()
+	bool		Armed = false;			// true if the controls are left set up between frames for Shoot()
+	uint32_t	SettledTime;			// in ms - time the controls left set up have settled
+	uint32_t	Settle = 20000;			// in us - time to let the controls settle before a frame
+
+	bool		Burst = false;			// true if shooting a burst
+	uint32_t	BurstInterval = 200000;	// in us - time between burst frames
+	uint32_t	BurstHold = 20000;		// in us - time to hold shutter signal for a burst frame
+	uint32_t	BurstTime;				// in us - time for the next burst action
+	Micronome	BurstTimer;				// timer for the burst frame schedule
+
+	RampSegment	Ramp[MaxSegments];		// the interval ramp schedule
+	uint8_t		Segments = 0;			// # segments in the ramp schedule (0 for a fixed Interval)
+	uint8_t		Segment = 0;			// the current segment of the ramp schedule
+	uint		SegmentFrames;			// # frames remaining in the current segment
+	float		RampInterval;			// in ms - the current interval on the ramp
+	float		RampStep;				// the change in interval each frame (a ratio for an exponential curve)
+	float		RampCarry;				// in ms - the fraction of the interval carried to the next frame
+
+	FrameStamp	Stamps[StampFrames];	// ring of timestamps of the most recent frames
+	uint8_t		StampHead = 0;			// the next entry to be written in the ring
+	uint8_t		StampCount = 0;			// # frames in the ring
+	FrameStamp	Stamp;					// timestamps of the frame in progress
+	uint32_t	PrevShutter;			// in us - time the shutter was triggered for the previous frame
+	uint32_t	LastGap = 0;			// in us - interval scheduled from the previous frame (0 if none)
+	ErrorStats	IntervalError;			// error in the interval between shutter edges
+	ErrorStats	HoldError;				// error in the shutter hold time
+
+	uint32_t	LateMin = 0;			// in ms - least lateness of a focus against the schedule
+	uint32_t	LateMax = 0;			// in ms - greatest lateness of a focus against the schedule
+	uint32_t	LateSum = 0;			// in ms - total lateness of focuses against the schedule
+	uint		LateFrames = 0;			// # focuses in the lateness statistics
 };
 
 #endif
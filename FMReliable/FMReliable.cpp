@@ -0,0 +1,296 @@
+/*
+
+OOOOOOO OO   OO OOOOOO           OOO      OO            OOO      OOO
+ OO  OO OOO OOO  OO  OO           OO      OO             OO       OO
+ OO   O OOOOOOO  OO  OO           OO                     OO       OO
+ OO O   OOOOOOO  OO  OO  OOOOO    OO     OOO     OOOO    OOOOO    OO     OOOOO
+ OOOO   OO O OO  OOOOO  OO   OO   OO      OO        OO   OO  OO   OO    OO   OO
+ OO O   OO   OO  OO OO  OOOOOOO   OO      OO     OOOOO   OO  OO   OO    OOOOOOO
+ OO     OO   OO  OO  OO OO        OO      OO    OO  OO   OO  OO   OO    OO
+ OO     OO   OO  OO  OO OO   OO   OO      OO    OO  OO   OO  OO   OO    OO   OO
+OOOO    OO   OO OOO  OO  OOOOO   OOOO    OOOO    OOO OO OO OOO   OOOO    OOOOO
+
+
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMReliable.h"
+#if !defined(ARDUINO)
+#include <stdlib.h>
+#endif
+
+/// <summary>Parse a 2-digit hex sequence #.</summary>
+/// <param name="s">The first of the 2 digits.</param>
+/// <param name="seq">Receives the sequence #.</param>
+/// <returns>True if the digits are valid.</returns>
+static bool ParseSeq(const char* s, uint8_t& seq)
+{
+	seq = 0;
+	for (uint8_t i = 0; i < 2; ++i)
+	{
+		char c = s[i];
+		uint8_t d;
+		if (c >= '0' && c <= '9')
+			d = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			d = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			d = c - 'A' + 10;
+		else
+			return false;
+		seq = (seq << 4) | d;
+	}
+	return true;
+}
+
+/// <summary>Format the header of a frame or ack.</summary>
+/// <param name="prefix">The Prefix of the Applet.</param>
+/// <param name="type">The type of frame, 'd' for data or 'a' for ack.</param>
+/// <param name="seq">The sequence #.</param>
+/// <returns>The header.</returns>
+static String Header(char prefix, char type, uint8_t seq)
+{
+	static const char hex[] = "0123456789abcdef";
+	char h[5] = { prefix, type, hex[seq >> 4], hex[seq & 0xF], '\0' };
+	return String(h);
+}
+
+/// <summary>Periodically poll activities for the Applet.</summary>
+/// <remarks>
+/// Sends the pending ack for frames received, sends the window again if the oldest frame hasn't been acknowledged,
+/// and sends the properties held back while the window was full as it frees.
+/// </remarks>
+void FMReliable::Run()
+{
+	if (AckPending)
+	{
+		AckPending = false;
+		Link->Output(Header(Prefix, 'a', RxNext - 1));
+	}
+	if (Pending() != 0 && millis() - SentMS >= RetryMS)
+	{
+		// go back to the oldest frame and send the window again
+		uint16_t start = WindowTail;
+		for (uint8_t seq = TxBase; seq != TxNext; ++seq)
+		{
+			Send(seq, start);
+			start = (start + Length[seq % ReliableFrames]) % ReliableWindowBytes;
+			++Retransmits;
+		}
+		SentMS = millis();
+	}
+	if (HeldCount != 0)
+		SendDeferred();
+}
+
+/// <summary>Process an input string, a data frame or an ack from the controller.</summary>
+/// <param name="s">The input string, following the Prefix.</param>
+void FMReliable::Input(const String& s)
+{
+	uint8_t seq;
+	if (s.length() < 3 || !ParseSeq(s.c_str() + 1, seq))
+	{
+		FMLOG_WARN(FMLOG_CAT_COMM, "invalid FMReliable input: ", s);
+		return;
+	}
+	switch (s[0])
+	{
+	case 'd':
+		// a data frame, acknowledged whether it's new or not
+		AckPending = true;
+		if (seq != RxNext)
+		{
+			++Duplicates;
+			return;
+		}
+		++RxNext;
+		Parent->Input(s.c_str() + 3, s.length() - 3);
+		break;
+	case 'a':
+		{
+			// an ack for all the frames up to seq (ignored if it's for frames not yet sent)
+			uint8_t acked = (uint8_t)(seq - TxBase + 1);
+			if (acked > Pending())
+				break;
+			// free the text of the frames acknowledged
+			if (acked != 0)
+				SentMS = millis();
+			for (; acked != 0; --acked, ++TxBase)
+			{
+				uint8_t len = Length[TxBase % ReliableFrames];
+				WindowTail = (WindowTail + len) % ReliableWindowBytes;
+				WindowUsed -= len;
+			}
+		}
+		break;
+	default:
+		FMLOG_WARN(FMLOG_CAT_COMM, "invalid FMReliable input: ", s);
+		break;
+	}
+}
+
+/// <summary>Output a message to the controller, as a data frame held in the window until it's acknowledged.</summary>
+/// <param name="s">The message to be output.</param>
+/// <returns>
+/// True if the message was sent, or held back to be sent as the window frees,
+/// or false if the Link is down or the window is full and the message can't be held back.
+/// </returns>
+bool FMReliable::Output(const String& s)
+{
+	uint16_t len = s.length();
+	if (len > 255 || len > ReliableWindowBytes)
+	{
+		// too long to hold, so send it as is
+		++Unsequenced;
+		return Link->Output(s);
+	}
+	if (Pending() == ReliableFrames || WindowUsed + len > ReliableWindowBytes)
+		return Defer(s);
+	// copy the text into the ring
+	uint16_t start = (WindowTail + WindowUsed) % ReliableWindowBytes;
+	for (uint16_t i = 0, at = start; i < len; ++i)
+	{
+		Window[at] = s[i];
+		if (++at == ReliableWindowBytes)
+			at = 0;
+	}
+	WindowUsed += len;
+	Length[TxNext % ReliableFrames] = len;
+	if (Pending() == 0)
+		SentMS = millis();
+	return Send(TxNext++, start);
+}
+
+/// <summary>Send a frame held in the window.</summary>
+/// <param name="seq">The sequence # of the frame.</param>
+/// <param name="start">The offset in the ring of the frame's text.</param>
+/// <returns>True if the Link sent the frame.</returns>
+bool FMReliable::Send(uint8_t seq, uint16_t start)
+{
+	uint8_t len = Length[seq % ReliableFrames];
+	String f = Header(Prefix, 'd', seq);
+	f.reserve(f.length() + len);
+	for (uint8_t i = 0; i < len; ++i)
+	{
+		f += Window[start];
+		if (++start == ReliableWindowBytes)
+			start = 0;
+	}
+	return Link->Output(f);
+}
+
+/// <summary>Hold back a property value that doesn't fit in the window, to be sent again as it frees.</summary>
+/// <param name="s">The message, which must be the value of a state property, e.g. "s=p1200".</param>
+/// <returns>True if the property is held back, or false if the message is refused.</returns>
+/// <remarks>
+/// Only the Applet's Prefix and the property code are kept, as the latest value is sent when there's room.
+/// Only the properties in the Applet's SnapshotProps are state, whose latest value supersedes the others;
+/// values of other properties, e.g. a stream of timestamps, and messages that aren't property values, are refused,
+/// so the caller knows they weren't sent.
+/// </remarks>
+bool FMReliable::Defer(const String& s)
+{
+	if (s.length() < 3 || s[1] != '=')
+	{
+		++WindowFull;
+		return false;
+	}
+	for (uint8_t i = 0; i < HeldCount; ++i)
+	{
+		if (Held[i][0] == s[0] && Held[i][1] == s[2])
+		{
+			++Deferred;
+			return true;			// coalesced with the value already held back
+		}
+	}
+	Applet* applet = Parent->FindApplet(s[0]);
+	const char* props = applet == NULL ? NULL : applet->SnapshotProps();
+	if (props == NULL || strchr(props, s[2]) == NULL || HeldCount == ReliableDeferred)
+	{
+		++WindowFull;
+		return false;
+	}
+	++Deferred;
+	Held[HeldCount][0] = s[0];
+	Held[HeldCount][1] = s[2];
+	++HeldCount;
+	return true;
+}
+
+/// <summary>Send the properties held back, oldest first, while there's room in the window.</summary>
+/// <remarks>
+/// Each is sent through its Applet's SendProp, so with its latest value, and any that still don't fit are held back again.
+/// </remarks>
+void FMReliable::SendDeferred()
+{
+	for (uint8_t n = HeldCount; n != 0 && Pending() < ReliableFrames; --n)
+	{
+		char prefix = Held[0][0];
+		char prop = Held[0][1];
+		--HeldCount;
+		memmove(Held[0], Held[1], HeldCount * sizeof(Held[0]));
+		Applet* applet = Parent->FindApplet(prefix);
+		if (applet != NULL)
+			applet->SendProp(prop);
+	}
+}
+
+/// <summary>Notification that the link to the controller has gone up or down.</summary>
+/// <remarks>
+/// Whether the link has gone up or down, frames not yet acknowledged and properties held back are abandoned,
+/// and both directions start again from sequence # 0. The snapshot sent as the link comes up brings
+/// the controller up to date.
+/// </remarks>
+void FMReliable::LinkChanged(bool)
+{
+	TxBase = TxNext = 0;
+	WindowTail = WindowUsed = 0;
+	HeldCount = 0;
+	RxNext = 0;
+	AckPending = false;
+}
+
+#if !defined(ARDUINO)
+/// <summary>Connect two ends of the loopback link.</summary>
+/// <param name="peer">The other end.</param>
+void FMLoopback::Connect(FMLoopback* peer)
+{
+	Peer = peer;
+	peer->Peer = this;
+}
+
+/// <summary>Periodically poll activities for the Applet.</summary>
+/// <remarks>
+/// Passes the messages queued by the other end to the Parent App Input.
+/// </remarks>
+void FMLoopback::Run()
+{
+	while (QueueCount != 0)
+	{
+		String s = Queue[(QueueHead + QueueSize - QueueCount) % QueueSize];
+		--QueueCount;
+		Parent->Input(s);
+	}
+}
+
+/// <summary>Output a message to the other end, unless it's dropped.</summary>
+/// <param name="s">The message to be output.</param>
+/// <returns>True if the message was sent (even if it was then dropped).</returns>
+bool FMLoopback::Output(const String& s)
+{
+	if (Peer == NULL || Peer->QueueCount == QueueSize)
+		return false;
+	++Sent;
+	if (rand() % 100 < DropPercent)
+	{
+		++Dropped;
+		return true;
+	}
+	Peer->Queue[Peer->QueueHead] = s;
+	Peer->QueueHead = (Peer->QueueHead + 1) % QueueSize;
+	++Peer->QueueCount;
+	return true;
+}
+#endif
@@ -0,0 +1,146 @@
+/*
+
+OOOOOOO OO   OO OOOOOO           OOO      OO            OOO      OOO
+ OO  OO OOO OOO  OO  OO           OO      OO             OO       OO
+ OO   O OOOOOOO  OO  OO           OO                     OO       OO
+ OO O   OOOOOOO  OO  OO  OOOOO    OO     OOO     OOOO    OOOOO    OO     OOOOO
+ OOOO   OO O OO  OOOOO  OO   OO   OO      OO        OO   OO  OO   OO    OO   OO
+ OO O   OO   OO  OO OO  OOOOOOO   OO      OO     OOOOO   OO  OO   OO    OOOOOOO
+ OO     OO   OO  OO  OO OO        OO      OO    OO  OO   OO  OO   OO    OO
+ OO     OO   OO  OO  OO OO   OO   OO      OO    OO  OO   OO  OO   OO    OO   OO
+OOOO    OO   OO OOO  OO  OOOOO   OOOO    OOOO    OOO OO OO OOO   OOOO    OOOOO
+
+
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMReliable_h
+#define _FMReliable_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <FMDebug.h>
+#include <Applet.h>
+#include <Metronome.h>
+
+// the # frames in the retransmit window
+// (may be defined in the build; no more than 128)
+#ifndef ReliableFrames
+#define ReliableFrames 8
+#endif
+
+// the size in bytes of the ring holding the text of the frames in the retransmit window
+// (may be defined in the build; messages longer than this, or than 255 bytes, are sent unsequenced)
+#ifndef ReliableWindowBytes
+#define ReliableWindowBytes 256
+#endif
+
+// the # properties that can be held back while the window is full, to be sent as it frees
+// (may be defined in the build)
+#ifndef ReliableDeferred
+#define ReliableDeferred 32
+#endif
+
+/// <summary>An Applet adding sequenced, acknowledged delivery to the messages of a communications Applet.</summary>
+/// <remarks>
+/// FMReliable is set as the App OutputApplet in place of its Link, e.g. an FMBlue Applet, and wraps each message
+/// Output as a data frame, its Prefix, 'd', a 2-digit hex sequence # and the message, e.g. "~d07s=p1200".
+/// The controller acknowledges the frames it has received in order with an ack, the Prefix, 'a' and the sequence #
+/// of the last of them, e.g. "~a07". Frames not yet acknowledged are held in a fixed window of ReliableFrames,
+/// with their text in a ring of ReliableWindowBytes, so one long message can use the room of several short ones.
+/// If the oldest frame isn't acknowledged within RetryMS, it and all that follow are sent again.
+/// A value of a state property, one in its Applet's SnapshotProps, Output while the window is full, e.g. by SendProp
+/// or the snapshot sent as the link comes up, is held back as just its Applet's Prefix and property code,
+/// and several values of one property are coalesced. As acks free the window, each property held back is sent again
+/// with its latest value by its Applet's SendProp. Other messages, including the values of properties that are
+/// events rather than state, are refused while the window is full, and Output returns false.
+/// A repeated ack doesn't delay the retransmit of the oldest frame.
+/// The controller can send frames the same way. Frames received in order are passed to the Parent App Input,
+/// and acknowledged in the next Run. Duplicates and frames out of order are dropped and the last frame
+/// received in order is acknowledged again, so the sender retransmits what's missing.
+/// Unframed messages still pass through, so a controller can mix framed and plain messages.
+/// Both directions start again from sequence # 0 each time the link comes up.
+/// </remarks>
+class FMReliable : public Applet
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="link">The communications Applet that carries the frames.</param>
+	FMReliable(char prefix, Applet* link) : Applet(prefix), Link(link) { Name = "Reliable"; }
+
+	void		Setup() { }
+	void		Run();
+	void		Input(const String& s);
+	bool		Output(const String& s);
+	/// <summary>Determine if the Link to the controller is up.</summary>
+	bool		LinkUp() { return Link->LinkUp(); }
+	void		LinkChanged(bool);
+
+	uint32_t	RetryMS = 250;		// in ms - time to wait for the oldest frame to be acknowledged before sending it again
+	uint32_t	Retransmits = 0;	// # frames sent again
+	uint32_t	Duplicates = 0;		// # frames received again, or out of order, and dropped
+	uint32_t	WindowFull = 0;		// # messages refused because the window was full
+	uint32_t	Deferred = 0;		// # property values held back because the window was full
+	uint32_t	Unsequenced = 0;	// # messages too long for the window, sent without a frame
+
+private:
+	bool		Send(uint8_t seq, uint16_t start);
+	bool		Defer(const String& s);
+	void		SendDeferred();
+	uint8_t		Pending() { return (uint8_t)(TxNext - TxBase); }
+
+	Applet*		Link;				// The communications Applet that carries the frames
+	char		Window[ReliableWindowBytes];	// The ring of the text of the frames sent but not yet acknowledged
+	uint8_t		Length[ReliableFrames];	// The length of the text of each frame, by sequence # modulo ReliableFrames
+	uint16_t	WindowTail = 0;		// The offset in the ring of the text of the oldest frame
+	uint16_t	WindowUsed = 0;		// # bytes of the ring in use
+	char		Held[ReliableDeferred][2];	// The Prefix and property code of each property held back, oldest first
+	uint8_t		HeldCount = 0;		// # properties held back
+	uint8_t		TxBase = 0;			// The sequence # of the oldest frame not yet acknowledged
+	uint8_t		TxNext = 0;			// The sequence # of the next frame to send
+	uint32_t	SentMS;				// in ms - time the oldest frame not yet acknowledged was last sent
+	uint8_t		RxNext = 0;			// The sequence # of the next frame expected from the controller
+	bool		AckPending = false;	// True if an ack is to be sent in the next Run
+};
+
+#if !defined(ARDUINO)
+/// <summary>A lossy loopback link between two Apps, for testing FMReliable on a host.</summary>
+/// <remarks>
+/// Each end is a communications Applet, set as the Link of an FMReliable (or as an OutputApplet) in its own App.
+/// Messages Output at one end are dropped with a probability of DropPercent, and the rest are queued to be
+/// passed to the Input of the other end's App when it Runs.
+/// </remarks>
+class FMLoopback : public Applet
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="dropPercent">The percentage of messages to drop.</param>
+	FMLoopback(char prefix, uint8_t dropPercent) : Applet(prefix), DropPercent(dropPercent) { Name = "Loopback"; }
+
+	void		Setup() { }
+	void		Run();
+	bool		Output(const String& s);
+	void		Connect(FMLoopback* peer);
+
+	static const uint8_t QueueSize = 32;	// # messages that can be queued for the other end
+	uint8_t		DropPercent;		// The percentage of messages to drop
+	uint32_t	Sent = 0;			// # messages Output
+	uint32_t	Dropped = 0;		// # messages dropped
+
+private:
+	FMLoopback*	Peer = NULL;		// The other end of the link
+	String		Queue[QueueSize];	// The messages Output by the other end, to be Input
+	uint8_t		QueueHead = 0;		// The index of the next message to be queued
+	uint8_t		QueueCount = 0;		// # messages queued
+};
+#endif
+
+#endif
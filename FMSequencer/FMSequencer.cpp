@@ -0,0 +1,173 @@
+/*
+
+OOOOOOO OO   OO  OOOOO
+ OO  OO OOO OOO OO   OO
+ OO   O OOOOOOO OO   OO
+ OO O   OOOOOOO  OO      OOOOO   OOO OO OO  OO   OOOOO  OO OOO   OOOOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO   OO   OO OO  OO  OO  OO  OO   OO  OO  OO OO   OO OO   OO  OO  OO
+ OO O   OO   OO     OO  OOOOOOO OO  OO  OO  OO  OOOOOOO  OO  OO OO      OOOOOOO  OO  OO
+ OO     OO   OO OO   OO OO      OO  OO  OO  OO  OO       OO  OO OO      OO       OO
+ OO     OO   OO OO   OO OO   OO  OOOOO  OO  OO  OO   OO  OO  OO OO   OO OO   OO  OO
+OOOO    OO   OO  OOOOO   OOOOO      OO   OOO OO  OOOOO   OO  OO  OOOOO   OOOOO  OOOO
+                                    OO
+                                   OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMSequencer.h"
+
+/// <summary>Add an axis to be moved between frames.</summary>
+/// <param name="axis">The stepper for the axis.</param>
+/// <returns>True if added, false if there are already MaxAxes axes.</returns>
+/// <remarks>The axis increment starts at zero.</remarks>
+bool FMSequencer::AddAxis(FMStepper* axis)
+{
+	if (AxisCount >= MaxAxes)
+		return false;
+	Axes[AxisCount] = axis;
+	Increments[AxisCount] = 0;
+	++AxisCount;
+	return true;
+}
+
+/// <summary>Periodically poll activities for the Applet.</summary>
+void FMSequencer::Run()
+{
+	switch (Status)
+	{
+	case Idle:		// nothing to do
+		break;
+	case Moving:
+		{
+			// wait for all the axes to stop, whether at their targets or held short of them at a limit
+			for (uint8_t i = 0; i < AxisCount; ++i)
+			{
+				if (Axes[i]->GetStatus() == FMStepper::Moving)
+					return;
+			}
+			SettleTime = millis() + Settle;
+			Status = Settling;				// next action
+		}
+		break;
+	case Settling:
+		{
+			uint32_t ms = millis();
+			// wait for the axes to settle and for the frame to be due
+			if ((int32_t)(ms - SettleTime) < 0 || (int32_t)(ms - FrameTime) < 0)
+				return;
+			if (Camera->Shoot())
+				Status = Shooting;			// next action
+		}
+		break;
+	case Shooting:
+		{
+			if (Camera->Busy())				// wait
+				return;
+			// the frame is done
+			if (Frames == 0 || --Frames == 0)
+			{
+				// sequence done!
+				Camera->Disarm();			// release the camera controls
+				Status = Idle;
+				SendProp(Prop_Frames);		// notify controller
+				return;
+			}
+			SendProp(Prop_Frames);			// notify controller of progress
+			// schedule the next frame an Interval after this one was, and move to it
+			FrameTime += Interval;
+			Move();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/// <summary>Start moving all the axes by their increments.</summary>
+void FMSequencer::Move()
+{
+	for (uint8_t i = 0; i < AxisCount; ++i)
+	{
+		if (Increments[i] != 0)
+			Axes[i]->SetTargetPosition(Axes[i]->GetTargetPosition() + Increments[i]);
+	}
+	Status = Moving;
+}
+
+/// <summary>Set a property value.</summary>
+/// <param name="prop">The property to set.</param>
+/// <param name="v">The value to set.</param>
+bool FMSequencer::SetProp(char prop, const String& v)
+{
+	switch (prop)
+	{
+	case Prop_Interval:
+		Interval = v.toInt();
+		break;
+	case Prop_Frames:
+		Frames = v.toInt();
+		if (Frames == 0)
+		{
+			// stop any sequence in progress, leaving the axes where they are
+			if (Status == Moving)
+			{
+				for (uint8_t i = 0; i < AxisCount; ++i)
+					Axes[i]->Stop();
+			}
+			if (Status != Idle)
+				Camera->Disarm();
+			Status = Idle;
+		}
+		else if (Status == Idle)
+		{
+			// setting the #frames starts the sequence, with the first frame shot where we stand
+			FrameTime = millis();
+			SettleTime = FrameTime;
+			Status = Settling;
+		}
+		break;
+	case Prop_Settle:
+		Settle = v.toInt();
+		break;
+	default:
+		if (prop >= Prop_Increment && prop < Prop_Increment + AxisCount)
+		{
+			Increments[prop - Prop_Increment] = v.toFloat();
+			break;
+		}
+		return false;
+	}
+	return true;
+}
+
+/// <summary>Get a property value as a string.</summary>
+/// <param name="prop">The property to get.</param>
+String FMSequencer::GetProp(char prop)
+{
+	switch (prop)
+	{
+	case Prop_Interval:
+		return String(Interval);
+	case Prop_Frames:
+		return String(Frames);
+	case Prop_Settle:
+		return String(Settle);
+	default:
+		if (prop >= Prop_Increment && prop < Prop_Increment + AxisCount)
+			return String(Increments[prop - Prop_Increment]);
+		return (String)NULL;
+	}
+}
+
+/// <summary>Get the properties sent to the controller as a snapshot of the Applet's state.</summary>
+/// <returns>The null-terminated list of property character codes.</returns>
+/// <remarks>
+/// The settings and progress of the sequence. The axis increments aren't included, as their number varies.
+/// </remarks>
+const char* FMSequencer::SnapshotProps()
+{
+	static const char props[] = { Prop_Interval, Prop_Frames, Prop_Settle, '\0' };
+	return props;
+}
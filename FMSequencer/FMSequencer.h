@@ -0,0 +1,101 @@
+/*
+
+OOOOOOO OO   OO  OOOOO
+ OO  OO OOO OOO OO   OO
+ OO   O OOOOOOO OO   OO
+ OO O   OOOOOOO  OO      OOOOO   OOO OO OO  OO   OOOOO  OO OOO   OOOOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO   OO   OO OO  OO  OO  OO  OO   OO  OO  OO OO   OO OO   OO  OO  OO
+ OO O   OO   OO     OO  OOOOOOO OO  OO  OO  OO  OOOOOOO  OO  OO OO      OOOOOOO  OO  OO
+ OO     OO   OO OO   OO OO      OO  OO  OO  OO  OO       OO  OO OO      OO       OO
+ OO     OO   OO OO   OO OO   OO  OOOOO  OO  OO  OO   OO  OO  OO OO   OO OO   OO  OO
+OOOO    OO   OO  OOOOO   OOOOO      OO   OOO OO  OOOOO   OO  OO  OOOOO   OOOOO  OOOO
+                                    OO
+                                   OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMSequencer_h
+#define _FMSequencer_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <FMDebug.h>
+#include <Applet.h>
+#include <FMIvalometer.h>
+#include <FMStepper.h>
+
+/// <summary>An Applet sequencing shoot-move-shoot motion time-lapse on the device.</summary>
+/// <remarks>
+/// FMSequencer coordinates an FMIvalometer and one or more FMStepper axes directly, so that a motion time-lapse
+/// doesn't need the controller to wait for each frame, send new stepper targets and wait for them to be reached.
+/// The first frame is shot where the axes stand. For each subsequent frame, each axis is moved by its increment,
+/// the sequencer waits for all axes to stop and then for the Settle time, and then the frame is shot.
+/// Frames are scheduled on an absolute timeline, an Interval apart, but never before the move and settle are done.
+/// An Interval of zero shoots each frame as soon as it is ready.
+/// Setting Frames starts a sequence and setting it to zero stops one. Progress is reported as the remaining Frames.
+/// </remarks>
+class FMSequencer : public Applet
+{
+public:
+	/// <summary>The maximum number of axes that can be sequenced.</summary>
+	static const uint8_t MaxAxes = 4;
+
+	/// <summary>Constructor.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="camera">The intervalometer used to shoot the frames.</param>
+	FMSequencer(char prefix, FMIvalometer* camera) : Applet(prefix)
+	{
+		Name = "Sequencer";
+		Camera = camera;
+	}
+
+	void		Setup() { }
+	void		Run();
+	bool		SetProp(char prop, const String& v);
+	String		GetProp(char prop);
+	const char*	SnapshotProps();
+
+	bool		AddAxis(FMStepper* axis);
+
+	/// <summary>Properties exposed to the communications interface.</summary>
+	/// <remarks>The enum values represent the character codes used in the Input/Output strings.</remarks>
+	enum Properties
+	{
+		Prop_Interval = 'i',
+		Prop_Frames = 'f',
+		Prop_Settle = 'w',
+		Prop_Increment = '0',	// '0', '1', ... - the increment for each axis, in the order added
+	};
+
+private:
+	/// <summary>The state of the shoot-move-shoot cycle.</summary>
+	enum SequenceStatus
+	{
+		Idle,		// no sequence active
+		Moving,		// waiting for the axes to reach their next positions
+		Settling,	// waiting for the axes to settle and for the next frame time
+		Shooting	// waiting for the frame to be shot
+	};
+
+	void		Move();
+
+	FMIvalometer* Camera;				// the intervalometer used to shoot the frames
+	FMStepper*	Axes[MaxAxes];			// the axes moved between frames
+	float		Increments[MaxAxes];	// in each axis' units - the move for each axis between frames
+	uint8_t		AxisCount = 0;			// # axes added
+
+	SequenceStatus Status = Idle;		// state of the cycle
+	uint32_t	FrameTime;				// in ms - scheduled time to shoot the next frame
+	uint32_t	SettleTime;				// in ms - time the axes will have settled
+	uint32_t	Interval = 0;			// in ms - time between frames
+	uint32_t	Settle = 500;			// in ms - time to let the axes settle after a move
+	uint		Frames = 0;				// # frames remaining to shoot
+};
+
+#endif
@@ -17,6 +17,11 @@ OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
 */
 
 #include "FMStepper.h"
+#include <FMCounter.h>
+
+FMCounter LimitHits("lim");			// # times a limit switch was hit while moving toward it
+FMCounter LateSteps("late");		// # times steppers were late enough to lose steps
+FMCounter CatchUpSteps("catchup");	// # steps hurried to make up lost time
 
 /// <summary>One-time Setup initialization for the Applet.</summary>
 void FMStepper::Setup()
@@ -36,7 +41,7 @@ void FMStepper::Run()
 	// check hitting the limit switch
 	if (LimitPin != -1)
 	{
-		bool lim = digitalRead(LimitPin) == LOW;
+		bool lim = Motor != NULL ? Motor->LimitActive(LimitPin) : digitalRead(LimitPin) == LOW;
 		if (AtLimit != lim)
 		{
 			// there's a change
@@ -45,6 +50,7 @@ void FMStepper::Run()
 			{
 				// hit limit while moving toward it
 				// NOTE: a mechanical switch may bounce while moving away!
+				++LimitHits;
 				SetCurrentPosition(MinLimit);		// (re)calibrate home position
 				SendProp(Prop_Position);			// notify the controller
 				SendProp(Prop_TargetPosition);		// side effect!
@@ -74,9 +80,10 @@ void FMStepper::Run()
 		}
 	}
 
-	if (Timer)
+	if (Timer && Parent->Linked())
 	{
 		// check for interesting changes and notify the controller
+		// (while unlinked, the snapshot on reconnect will bring the controller up to date)
 		if (GetDistanceToGo() != 0)
 		{
 			SendProp(Prop_Position);
@@ -137,6 +144,12 @@ bool FMStepper::SetProp(char prop, const String& v)
 	case Prop_MicrosPerStep:
 		SetMicrosPerStep(v.toInt());
 		break;
+	case Prop_BurstLimit:
+		BurstLimit = v.toInt();
+		break;
+	case Prop_LateCount:
+		LateCount = v.toInt();
+		break;
 	default:
 		return false;
 	}
@@ -169,17 +182,38 @@ String FMStepper::GetProp(char prop)
 		return String(MinLimit);
 	case Prop_MicrosPerStep:
 		return String(GetMicrosPerStep());
+	case Prop_BurstLimit:
+		return String(BurstLimit);
+	case Prop_LateCount:
+		return String(LateCount);
+	case Prop_MoveTime:
+		return String(PredictMoveTime(GetTargetPosition()), 3);
+	case Prop_MoveError:
+		return String(GetLastMoveError(), 3);
 	case Prop_Velocity:	// write-only
 	default:
 		return (String)NULL;
 	}
 }
 
+/// <summary>Get the properties sent to the controller as a snapshot of the Applet's state.</summary>
+/// <returns>The null-terminated list of property character codes.</returns>
+/// <remarks>
+/// The state of the motion, but not the diagnostics, which the controller asks for as it needs them.
+/// </remarks>
+const char* FMStepper::SnapshotProps()
+{
+	static const char props[] = { Prop_Position, Prop_TargetPosition, Prop_Speed, Prop_MaxSpeed, Prop_Acceleration, Prop_Calibrated, '\0' };
+	return props;
+}
+
 /// <summary>Moves the stepper as required toward any target position that may be set.</summary>
 /// <returns>The updated state of stepper movement.</returns>
 /// <remarks>
-/// Based on the time interval since the last call, the stepper may be moved at most one step toward any set target position.
+/// Based on the time interval since the last call, the stepper is normally moved at most one step toward any set target position.
 /// Run() should be called frequently enough to achieve the desired speed and acceleration.
+/// If the stepper is an FMAccelStepper, steps taken late are made up by hurrying the following steps,
+/// up to BurstLimit step intervals, and each step late by a whole interval is counted in LateCount.
 /// The call to Run() that achieves the target position will return a status of ReachedGoal.
 /// Subsequent calls, with no intervening movement directives, will return a status of Stopped.
 /// </remarks>
@@ -191,46 +225,68 @@ FMStepper::RunStatus FMStepper::Step()
 	}
 
 	// don't let the stepper move beyond the set limits
-	long dist = Stepper->distanceToGo();
+	long dist = StepperDistanceToGo();
 	if (dist != 0 && !Calibrating)
 	{
 		float pos = GetCurrentPosition();
 		if (pos >= MaxLimit && dist > 0
 			|| pos <= MinLimit && dist < 0)
 		{
+			if (Engine != NULL)
+				Engine->Halt(Axis);		// the Engine would otherwise keep stepping on its own
 			return ReachedGoal;
 		}
 	}
 
 	// move the stepper
-	if (!Stepper->run())
+	bool running = StepperRun();
+	if (Motor != NULL)
+	{
+		// make up the time of any steps taken late, each on its own Run, so the limits above are checked before each one
+		// (never while calibrating, so we don't drive any further into the limit switch)
+		if (Motor->Hurry(Calibrating ? 0 : BurstLimit))
+		{
+			++LateCount;
+			++LateSteps;
+		}
+	}
+	if (!running)
 	{
 		// movement is done
 		IsMoving = false;
 		// record the stop time
 		MoveStopTime = millis();
 		// status depends on if we reached the target
-		if (Stepper->distanceToGo() == 0)
+		if (StepperDistanceToGo() == 0)
 			return ReachedGoal;
 		return Stopped;
 	}
+
 	return Moving;
 }
 
+/// <summary>Get the status of the stepper movement.</summary>
+/// <returns>The status returned by Step on the last Run, or Moving if a move has been set since.</returns>
+/// <remarks>A move held short of its target at a limit reports ReachedGoal, not Moving.</remarks>
+FMStepper::RunStatus FMStepper::GetStatus()
+{
+	return LastStatus;
+}
+
 /// <summary>Stops the stepper as quickly as possible.</summary>
 /// <remarks>
 /// Sets a new target position that causes the stepper to stop as quickly as possible, using the current speed and acceleration parameters.
 /// </remarks>
 void FMStepper::Stop()
 {
-	Stepper->stop();
+	StepperStop();
 }
 
 /// <summary>Get the target position.</summary>
 /// <returns>The target position, in logical units.</returns>
 float FMStepper::GetTargetPosition()
 {
-	return Stepper->targetPosition() / StepsPerUnit;
+	return StepperTargetPosition() / StepsPerUnit;
 }
 
 /// <summary>Sets the stepper moving toward a new target position.</summary>
@@ -242,9 +298,12 @@ void FMStepper::SetTargetPosition(float position)
 		position = MaxLimit;
 	else if (position < MinLimit)
 		position = MinLimit;
+	// predict the duration from the current state, for comparison when the move is done
+	MovePrediction = PredictMoveTime(position);
 	// set it moving
-	Stepper->moveTo((long)roundf(position * StepsPerUnit));
+	StepperMoveTo((long)roundf(position * StepsPerUnit));
 	IsMoving = true;
+	LastStatus = Moving;		// until the next Run reports otherwise
 	MoveStartTime = millis();
 }
 
@@ -252,7 +311,7 @@ void FMStepper::SetTargetPosition(float position)
 /// <returns>The current position, in logical units.</returns>
 float FMStepper::GetCurrentPosition()
 {
-	return Stepper->currentPosition() / StepsPerUnit;
+	return StepperCurrentPosition() / StepsPerUnit;
 }
 
 /// <summary>Set the current position.</summary>
@@ -263,7 +322,7 @@ float FMStepper::GetCurrentPosition()
 /// </remarks>
 void FMStepper::SetCurrentPosition(float position)
 {
-	Stepper->setCurrentPosition((long)roundf(position * StepsPerUnit));
+	StepperSetCurrentPosition((long)roundf(position * StepsPerUnit));
 	// this will stop a current movement in progress
 	IsMoving = false;
 	MoveStopTime = millis();
@@ -282,21 +341,21 @@ void FMStepper::SetAcceleration(float accel)
 {
 	// record the Acceleration value, since we can't recover it from the AccelStepper implementation
 	Acceleration = accel * StepsPerUnit;
-	Stepper->setAcceleration(Acceleration);
+	StepperSetAcceleration(Acceleration);
 }
 
 /// <summary>Get the speed of current movement.</summary>
 /// <returns>The speed of current movement, in logical units.</returns>
 float FMStepper::GetSpeed()
 {
-	return Stepper->speed() / StepsPerUnit;
+	return StepperSpeed() / StepsPerUnit;
 }
 
 /// <summary>Get the maximum speed used for movement.</summary>
 /// <returns>The maximum speed, in logical units.</returns>
 float FMStepper::GetMaxSpeed()
 {
-	return Stepper->maxSpeed() / StepsPerUnit;
+	return StepperMaxSpeed() / StepsPerUnit;
 }
 
 /// <summary>Set the maximum speed used for movement.</summary>
@@ -310,7 +369,7 @@ void FMStepper::SetMaxSpeed(float speed)
 	if (SpeedLimit != 0 && speed > SpeedLimit)
 		speed = SpeedLimit;
 	speed *= StepsPerUnit;
-	Stepper->setMaxSpeed(speed);
+	StepperSetMaxSpeed(speed);
 }
 
 /// <summary>Get the upper limit for speeds allowed for movement.</summary>
@@ -352,8 +411,9 @@ void FMStepper::Calibrate()
 	Calibrated = false;
 	Calibrating = true;
 	SetMaxSpeed(GetSpeedLimit());
+	MovePrediction = 0;		// the distance to the limit switch is unknown
 	// set it moving toward the limit switch
-	Stepper->moveTo(-2000000000L);
+	StepperMoveTo(-2000000000L);
 	IsMoving = true;
 	MoveStartTime = millis();
 }
@@ -387,7 +447,7 @@ void FMStepper::SetScale(float scale)
 /// <returns>The microseconds per step.</returns>
 uint32_t FMStepper::GetMicrosPerStep()
 {
-	return 1000000L / Stepper->maxSpeed();
+	return 1000000L / StepperMaxSpeed();
 }
 
 /// <summary>Set the minimum number of microseconds per step.</summary>
@@ -398,19 +458,164 @@ uint32_t FMStepper::GetMicrosPerStep()
 /// </remarks>
 void FMStepper::SetMicrosPerStep(uint32_t usPerStep)
 {
-	Stepper->setMaxSpeed(1000000.0 / usPerStep);
+	StepperSetMaxSpeed(1000000.0 / usPerStep);
 }
 
 /// <summary>Get the duration of the last completed move.</summary>
-/// <returns>The duration, in milliseconds, of the last completed move.</returns>
+/// <returns>The duration, in seconds, of the last completed move.</returns>
 float FMStepper::GetLastMoveTime()
 {
 	return (MoveStopTime - MoveStartTime) / 1000.0;
 }
 
+/// <summary>Predict the time for a move from the current state to a target position.</summary>
+/// <param name="position">The target position, in logical units.</param>
+/// <returns>The predicted duration of the move, in seconds.</returns>
+/// <remarks>
+/// The prediction uses the current position and speed along with the Acceleration and MaxSpeed settings,
+/// over the ideal trapezoidal (or triangular, if MaxSpeed is never reached) speed profile.
+/// Any current motion away from the target, or too fast to stop before it, is first brought to rest.
+/// </remarks>
+float FMStepper::PredictMoveTime(float position)
+{
+	// work in steps, with distance and speed taken positive in the direction of the target
+	float dist = position * StepsPerUnit - StepperCurrentPosition();
+	float v = StepperSpeed();
+	if (dist < 0)
+	{
+		dist = -dist;
+		v = -v;
+	}
+	float vmax = StepperMaxSpeed();
+	float a = Acceleration;
+	if (vmax <= 0)
+		return dist == 0 ? 0 : MAXFLOAT;	// will never get there
+	if (a <= 0)
+		return dist / vmax;					// no acceleration set - assume constant speed
+	float t = 0;
+	float stop = v * v / (2 * a);			// distance needed to come to rest from the current speed
+	if (v < 0)
+	{
+		// moving away from the target - come to rest, then start out from there
+		t = -v / a;
+		dist += stop;
+		v = 0;
+	}
+	else if (stop > dist)
+	{
+		// too fast to stop at the target - come to rest beyond it, then come back
+		t = v / a;
+		dist = stop - dist;
+		v = 0;
+	}
+	// peak speed reached if we accelerate and then decelerate to rest at the target
+	float peak = sqrtf(a * dist + v * v / 2);
+	if (peak <= vmax)
+	{
+		// triangular profile
+		return t + (peak - v) / a + peak / a;
+	}
+	// trapezoidal profile - ramp to MaxSpeed (possibly down to it, if MaxSpeed has been lowered), cruise, ramp down to rest
+	float ramp = fabs(vmax * vmax - v * v) / (2 * a);
+	float cruise = dist - ramp - vmax * vmax / (2 * a);
+	return t + fabs(vmax - v) / a + cruise / vmax + vmax / a;
+}
+
+/// <summary>Get the error in the predicted duration of the last completed move.</summary>
+/// <returns>The measured duration less the predicted duration, in seconds, of the last completed move.</returns>
+/// <remarks>
+/// The prediction is made by PredictMoveTime when the move is started.
+/// Moves interrupted by setting the current position, or by calibration, are not meaningful.
+/// </remarks>
+float FMStepper::GetLastMoveError()
+{
+	return GetLastMoveTime() - MovePrediction;
+}
+
 /// <summary>Get the remaining distance to be traveled for the current move.</summary>
 /// <returns>The distance remaining, in logical units.</returns>
 float FMStepper::GetDistanceToGo()
 {
-	return Stepper->distanceToGo() / StepsPerUnit;
+	return StepperDistanceToGo() / StepsPerUnit;
+}
+
+/// <summary>Read the limit switch.</summary>
+/// <param name="pin">The pin for monitoring the limit switch.</param>
+/// <returns>True if the limit switch is active/closed.</returns>
+bool FMAccelStepper::LimitActive(int8_t pin)
+{
+	return digitalRead(pin) == LOW;
+}
+
+/// <summary>Take a step, timing it against the schedule.</summary>
+/// <param name="step">The new position, in steps.</param>
+void FMAccelStepper::step(long step)
+{
+	Track();
+	AccelStepper::step(step);
+}
+
+/// <summary>Record the time of a step, and how far it was behind its schedule.</summary>
+/// <returns>The time since the last step, in microseconds.</returns>
+/// <remarks>
+/// Each step is due the Planned interval after the last step was due, which is Behind the time it was taken.
+/// A hurried step is taken at the planned speed, so AccelStepper computes the next speed from the plan.
+/// </remarks>
+uint32_t FMAccelStepper::Track()
+{
+	uint32_t now = micros();
+	uint32_t dt = now - LastStepTime;
+	LastStepTime = now;
+	int32_t late = Planned != 0 ? (int32_t)(dt + Behind - Planned) : 0;
+	Behind = late > 0 ? late : 0;
+	// a whole interval lost by this step alone, after the interval it waited for
+	Lost = Planned != 0 && dt >= StepInterval() + Planned;
+	if (Hurried)
+	{
+		setSpeed(PlannedSpeed);
+		Hurried = false;
+	}
+	Stepped = true;
+	return dt;
+}
+
+/// <summary>Shorten the interval to the next step, to make up for the steps being behind their schedule.</summary>
+/// <param name="limit">The most step intervals to make up. Any more time behind than this is given up.</param>
+/// <returns>True if the last step was taken late by at least one whole step interval.</returns>
+/// <remarks>
+/// Call after each run(). The next step is brought forward by the time behind, but never to less than
+/// half the planned interval, and never faster than MaxSpeed.
+/// </remarks>
+bool FMAccelStepper::Hurry(uint8_t limit)
+{
+	if (!Stepped)
+	{
+		// forget the schedule if the plan was changed, e.g. by moveTo or setCurrentPosition, rather than by a step
+		if (speed() != LeftSpeed)
+		{
+			Planned = 0;
+			Behind = 0;
+			Hurried = false;
+			LeftSpeed = speed();
+		}
+		return false;
+	}
+	Stepped = false;
+	PlannedSpeed = speed();
+	Planned = StepInterval();
+	if (Planned == 0)
+		Behind = 0;
+	// give up on any time beyond the limit
+	if (Behind > (uint32_t)limit * Planned)
+		Behind = (uint32_t)limit * Planned;
+	if (Behind != 0)
+	{
+		// bring the next step forward by the time behind (setSpeed holds it to MaxSpeed)
+		uint32_t next = Behind < Planned / 2 ? Planned - Behind : Planned / 2;
+		setSpeed(PlannedSpeed * Planned / next);
+		Hurried = true;
+		++CatchUpSteps;
+	}
+	LeftSpeed = speed();
+	return Lost;
 }
@@ -29,11 +29,54 @@ OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
 #include <Metronome.h>
 #include <Applet.h>
 #include <AccelStepper.h>
+#include <FMStepperEngine.h>
+
+/// <summary>An AccelStepper that can catch up on steps lost while the main loop was running late.</summary>
+/// <remarks>
+/// AccelStepper::run() emits at most one step per call and schedules the next step from the time of that call,
+/// so any time the main loop spends beyond one step interval is simply lost and the move runs slower than planned.
+/// FMAccelStepper times each step as it is taken, to track how far the steps have fallen behind their schedule,
+/// and Hurry shortens the interval to the next step to make up the time, as FMStepperEngine schedules each step
+/// from when it was due. The steps are never taken faster than twice the planned speed, nor faster than MaxSpeed,
+/// so a move cruising at MaxSpeed makes up its time on the ramp down.
+/// Only the public and protected AccelStepper interface is used.
+/// It also lets a simulated stepper (see FMVirtualStepper) stand in for the limit switch.
+/// </remarks>
+class FMAccelStepper : public AccelStepper
+{
+public:
+	/// <summary>Constructor for a stepper driven through output pins. See AccelStepper for details.</summary>
+	FMAccelStepper(uint8_t interface = AccelStepper::FULL4WIRE, uint8_t pin1 = 2, uint8_t pin2 = 3, uint8_t pin3 = 4, uint8_t pin4 = 5, bool enable = true)
+		: AccelStepper(interface, pin1, pin2, pin3, pin4, enable) { }
+
+	/// <summary>Constructor for a stepper driven through forward and backward step functions. See AccelStepper for details.</summary>
+	FMAccelStepper(void (*forward)(), void (*backward)()) : AccelStepper(forward, backward) { }
+
+	bool		Hurry(uint8_t limit);
+	virtual bool LimitActive(int8_t pin);
+	/// <summary>Get the current interval between steps, in microseconds (0 if not stepping).</summary>
+	uint32_t	StepInterval() { float s = fabs(speed()); return s == 0 ? 0 : (uint32_t)(1000000.0 / s); }
+
+	uint32_t	Behind = 0;			// in microseconds - how far the last step was behind its schedule
+	bool		Hurried = false;	// true if the next step has been hurried to make up time
+
+protected:
+	void		step(long step);
+	uint32_t	Track();
+
+	uint32_t	LastStepTime = 0;	// in microseconds - time of the last step
+	uint32_t	Planned = 0;		// in microseconds - planned interval to the next step, before any Hurry (0 if from rest)
+	float		PlannedSpeed = 0;	// in steps per second - planned speed for the next step, before any Hurry
+	float		LeftSpeed = 0;		// in steps per second - the speed left by the last Hurry, to notice changes to the plan
+	bool		Stepped = false;	// true if a step has been taken since the last Hurry
+	bool		Lost = false;		// true if the last step was taken a whole interval later than it was scheduled
+};
 
 /// <summary>An Applet for stepper motor control.</summary>
 /// <remarks>
 /// FMStepper allows user-friendly logical units to be used with an AccelStepper interface.
 /// See the AccelStepper documentation for additional usage information.
+/// Alternatively, an FMStepper can be a view of one axis of an FMStepperEngine, which does the actual stepping.
 /// </remarks>
 class FMStepper : public Applet
 {
@@ -53,9 +96,34 @@ public:
 		MinLimit = -MAXFLOAT;
 	}
 
+	/// <summary>Constructor for a stepper able to catch up on steps lost when Run is called late.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="stepsPerUnit">A scaling factor specifying the number of stepper steps per logical unit.</param>
+	/// <param name="stepper">A pointer to an FMAccelStepper object controlling the stepper motor.</param>
+	/// <param name="limitPin">Optional. The pin for monitoring a limit switch.</param>
+	FMStepper(char prefix, float stepsPerUnit, FMAccelStepper* stepper, int8_t limitPin = -1) :
+		FMStepper(prefix, stepsPerUnit, (AccelStepper*)stepper, limitPin)
+	{
+		Motor = stepper;
+	}
+
+	/// <summary>Constructor for a view of one axis of an FMStepperEngine.</summary>
+	/// <param name="prefix">The character code to associate with this Applet.</param>
+	/// <param name="stepsPerUnit">A scaling factor specifying the number of stepper steps per logical unit.</param>
+	/// <param name="engine">A pointer to the FMStepperEngine performing stepper movement.</param>
+	/// <param name="axis">The axis of the engine to control.</param>
+	/// <param name="limitPin">Optional. The pin for monitoring a limit switch.</param>
+	FMStepper(char prefix, float stepsPerUnit, FMStepperEngine* engine, uint8_t axis, int8_t limitPin = -1) :
+		FMStepper(prefix, stepsPerUnit, (AccelStepper*)NULL, limitPin)
+	{
+		Engine = engine;
+		Axis = axis;
+	}
+
 	void		Setup();
 	void		Run();
 	String		GetProp(char prop);
+	const char*	SnapshotProps();
 	bool		SetProp(char prop, const String& v);
 
 	/// <summary>Status of stepper movement.</summary>
@@ -81,9 +149,14 @@ public:
 		Prop_MaxLimit = 'x',
 		Prop_MinLimit = 'n',
 		Prop_MicrosPerStep = 'u',
+		Prop_BurstLimit = 'b',
+		Prop_LateCount = 'k',
+		Prop_MoveTime = 'e',
+		Prop_MoveError = 'r',
 	};
 
 	RunStatus	Step();
+	RunStatus	GetStatus();
 	void		Calibrate();
 	void		Stop();
 	float		GetTargetPosition();
@@ -104,11 +177,32 @@ public:
 	uint32_t	GetMicrosPerStep();
 	void		SetMicrosPerStep(uint32_t);
 	float		GetLastMoveTime();
+	float		PredictMoveTime(float position);
+	float		GetLastMoveError();
 	float		GetDistanceToGo();
 
-	AccelStepper *Stepper;		// the implementation actually performing stepper movement
+	AccelStepper *Stepper;		// the implementation actually performing stepper movement (NULL if an Engine axis)
+	FMStepperEngine *Engine = NULL;	// the engine performing stepper movement, if not an AccelStepper (NULL if not)
+	uint8_t		Axis = 0;		// the axis of the Engine
+	FMAccelStepper *Motor = NULL;	// the same stepper, if it is an FMAccelStepper (NULL if not)
+	uint8_t		BurstLimit = 4;	// maximum number of step intervals to make up when late
+	uint32_t	LateCount = 0;	// number of times Run was late by at least one whole step interval
 
 protected:
+	// the stepper operations used, on either the AccelStepper or the Engine axis, in steps
+	long		StepperCurrentPosition() { return Engine != NULL ? Engine->CurrentPosition(Axis) : Stepper->currentPosition(); }
+	long		StepperTargetPosition() { return Engine != NULL ? Engine->TargetPosition(Axis) : Stepper->targetPosition(); }
+	long		StepperDistanceToGo() { return Engine != NULL ? Engine->DistanceToGo(Axis) : Stepper->distanceToGo(); }
+	float		StepperSpeed() { return Engine != NULL ? Engine->Speed(Axis) : Stepper->speed(); }
+	float		StepperMaxSpeed() { return Engine != NULL ? Engine->MaxSpeed(Axis) : Stepper->maxSpeed(); }
+	void		StepperSetMaxSpeed(float speed) { if (Engine != NULL) Engine->SetMaxSpeed(Axis, speed); else Stepper->setMaxSpeed(speed); }
+	void		StepperSetAcceleration(float accel) { if (Engine != NULL) Engine->SetAcceleration(Axis, accel); else Stepper->setAcceleration(accel); }
+	void		StepperMoveTo(long position) { if (Engine != NULL) Engine->MoveTo(Axis, position); else Stepper->moveTo(position); }
+	void		StepperSetCurrentPosition(long position) { if (Engine != NULL) Engine->SetCurrentPosition(Axis, position); else Stepper->setCurrentPosition(position); }
+	void		StepperStop() { if (Engine != NULL) Engine->Stop(Axis); else Stepper->stop(); }
+	// the Engine steps the axis on its own, so just report if it's still running
+	bool		StepperRun() { return Engine != NULL ? Engine->Running(Axis) : Stepper->run(); }
+
 	Metronome	Timer;					// interval timer for feedback
 	RunStatus	LastStatus = Stopped;	// most recent status
 	float		LastSpeed = 0;			// most recent speed
@@ -122,9 +216,10 @@ protected:
 	float		MaxLimit;		// in units - maximum stepper position value
 	float		MinLimit;		// in units - minimum stepper position value
 	bool		IsMoving = false; // record of whether we're trying to move the stepper or not
-	uint32_t	MoveStartTime;	// record of the start time of the last move, in microseconds
-	uint32_t	MoveStopTime;	// record of the stop time of the last move, in microseconds
-	float		Acceleration;	// steps per second per second (not scaled units)
+	uint32_t	MoveStartTime;	// record of the start time of the last move, in milliseconds
+	uint32_t	MoveStopTime;	// record of the stop time of the last move, in milliseconds
+	float		MovePrediction = 0;	// in seconds - predicted duration of the last move, as it was started
+	float		Acceleration = 1;	// steps per second per second (not scaled units), initially the AccelStepper default
 };
 
 #endif
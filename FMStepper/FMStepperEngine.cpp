@@ -0,0 +1,267 @@
+/*
+
+OOOOOOO OO   OO  OOOOO     O
+ OO  OO OOO OOO OO   OO   OO
+ OO   O OOOOOOO OO   OO   OO
+ OO O   OOOOOOO  OO     OOOOOO   OOOOO  OO OOO  OO OOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO     OO    OO   OO  OO  OO  OO  OO OO   OO  OO  OO
+ OO O   OO   OO     OO    OO    OOOOOOO  OO  OO  OO  OO OOOOOOO  OO  OO
+ OO     OO   OO OO   OO   OO    OO       OO  OO  OO  OO OO       OO
+ OO     OO   OO OO   OO   OO OO OO   OO  OOOOO   OOOOO  OO   OO  OO
+OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
+                                         OO      OO
+                                        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMStepperEngine.h"
+
+/// <summary>Constructor.</summary>
+/// <param name="prefix">The character code to associate with this Applet.</param>
+/// <param name="axes">The number of axes to drive, at most MaxAxes.</param>
+/// <param name="output">Optional. A function to output the bitmasks of steps and their directions for each Tick.</param>
+FMStepperEngine::FMStepperEngine(char prefix, uint8_t axes, void (*output)(uint64_t steps, uint64_t directions)) : Applet(prefix)
+{
+	Name = "Engine";
+	StepOutput = output;
+	Axes = axes > MaxAxes ? MaxAxes : axes;
+	Position = new int32_t[Axes];
+	Target = new int32_t[Axes];
+	Interval = new uint32_t[Axes];
+	NextStep = new uint32_t[Axes];
+	Speeds = new float[Axes];
+	MaxSpeeds = new float[Axes];
+	Accel = new float[Axes];
+	N = new int32_t[Axes];
+	C0 = new float[Axes];
+	Cn = new float[Axes];
+	Cmin = new float[Axes];
+	Now = micros();		// until the first Tick
+	for (uint8_t i = 0; i < Axes; ++i)
+	{
+		Position[i] = Target[i] = 0;
+		Interval[i] = NextStep[i] = 0;
+		Speeds[i] = 0;
+		MaxSpeeds[i] = 0;
+		Accel[i] = 0;
+		N[i] = 0;
+		Cn[i] = 0;
+		// the same defaults as AccelStepper
+		SetMaxSpeed(i, 1);
+		SetAcceleration(i, 1);
+	}
+}
+
+/// <summary>Destructor.</summary>
+FMStepperEngine::~FMStepperEngine()
+{
+	delete[] Position;
+	delete[] Target;
+	delete[] Interval;
+	delete[] NextStep;
+	delete[] Speeds;
+	delete[] MaxSpeeds;
+	delete[] Accel;
+	delete[] N;
+	delete[] C0;
+	delete[] Cn;
+	delete[] Cmin;
+}
+
+/// <summary>Periodically poll activities for the Applet.</summary>
+/// <remarks>Run frequently to keep all the axes moving on time.</remarks>
+void FMStepperEngine::Run()
+{
+	uint64_t steps = Tick(micros());
+	if (steps != 0 && StepOutput != NULL)
+		StepOutput(steps, StepDirections);
+}
+
+/// <summary>Step all of the axes that are due.</summary>
+/// <param name="now">The current time, in microseconds.</param>
+/// <returns>A bitmask of the axes that stepped, with axis 0 in the least significant bit.</returns>
+/// <remarks>
+/// The positions of the axes stepped are updated, along with their speed and the time of their next step.
+/// StepDirections is set to the directions of the steps taken.
+/// </remarks>
+uint64_t FMStepperEngine::Tick(uint32_t now)
+{
+	Now = now;
+	// one pass over just the intervals and times of every axis to gather a mask of those due to step
+	// (& rather than && so the test needn't branch, though whether it doesn't is up to the compiler)
+	const uint32_t* interval = Interval;
+	const uint32_t* next = NextStep;
+	uint64_t due = 0;
+	for (uint8_t i = 0; i < Axes; ++i)
+		due |= (uint64_t)((interval[i] != 0) & ((int32_t)(now - next[i]) >= 0)) << i;
+	StepDirections = Forward;
+	// then step just those axes and update their speeds
+	uint64_t steps = due;
+	for (uint8_t i = 0; steps != 0; ++i, steps >>= 1)
+	{
+		if (!(steps & 1))
+			continue;
+		Position[i] += (Forward >> i) & 1 ? 1 : -1;
+		ComputeSpeed(i);
+		// schedule from when this step was due, but never fall more than one interval behind
+		uint32_t t = NextStep[i] + Interval[i];
+		if ((int32_t)(now - t) > (int32_t)Interval[i])
+			t = now;
+		NextStep[i] = t;
+	}
+	return due;
+}
+
+/// <summary>Compute the speed and step interval following a step or a change of target.</summary>
+/// <param name="axis">The axis.</param>
+/// <remarks>
+/// This is the AccelStepper algorithm (after David Austin), which approximates constant acceleration
+/// by adjusting the step interval of each step on the ramp.
+/// </remarks>
+void FMStepperEngine::ComputeSpeed(uint8_t axis)
+{
+	long distance = Target[axis] - Position[axis];
+	long stepsToStop = (long)((Speeds[axis] * Speeds[axis]) / (2.0 * Accel[axis]));
+	bool forward = (Forward >> axis) & 1;
+	if (distance == 0 && stepsToStop <= 1)
+	{
+		// we're at the target and nearly stopped - stop
+		Interval[axis] = 0;
+		Speeds[axis] = 0;
+		N[axis] = 0;
+		return;
+	}
+	if (distance > 0)
+	{
+		// the target is ahead - decelerate if we can only just stop or are going the wrong way
+		if (N[axis] > 0)
+		{
+			if (stepsToStop >= distance || !forward)
+				N[axis] = -stepsToStop;
+		}
+		else if (N[axis] < 0)
+		{
+			if (stepsToStop < distance && forward)
+				N[axis] = -N[axis];
+		}
+	}
+	else if (distance < 0)
+	{
+		// the target is behind - likewise
+		if (N[axis] > 0)
+		{
+			if (stepsToStop >= -distance || forward)
+				N[axis] = -stepsToStop;
+		}
+		else if (N[axis] < 0)
+		{
+			if (stepsToStop < -distance && !forward)
+				N[axis] = -N[axis];
+		}
+	}
+	if (N[axis] == 0)
+	{
+		// the first step from rest
+		Cn[axis] = C0[axis];
+		if (distance > 0)
+			Forward |= (uint64_t)1 << axis;
+		else
+			Forward &= ~((uint64_t)1 << axis);
+	}
+	else
+	{
+		// subsequent steps
+		Cn[axis] = Cn[axis] - ((2.0 * Cn[axis]) / ((4.0 * N[axis]) + 1));
+		if (Cn[axis] < Cmin[axis])
+			Cn[axis] = Cmin[axis];
+	}
+	++N[axis];
+	Interval[axis] = Cn[axis];
+	Speeds[axis] = (Forward >> axis) & 1 ? 1000000.0 / Cn[axis] : -1000000.0 / Cn[axis];
+}
+
+/// <summary>Set the target position of an axis.</summary>
+/// <param name="axis">The axis.</param>
+/// <param name="position">The target position, in steps.</param>
+/// <remarks>
+/// An axis starting from rest takes its first step at the next Tick, timed from the last one,
+/// so the schedule stays on whatever clock Tick is given.
+/// </remarks>
+void FMStepperEngine::MoveTo(uint8_t axis, long position)
+{
+	if (Target[axis] == position)
+		return;
+	bool stopped = Interval[axis] == 0;
+	Target[axis] = position;
+	ComputeSpeed(axis);
+	if (stopped)
+		NextStep[axis] = Now;	// starting from rest, the first step is due at the next Tick
+}
+
+/// <summary>Set the current position of an axis.</summary>
+/// <param name="axis">The axis.</param>
+/// <param name="position">The new current position, in steps.</param>
+/// <remarks>As with AccelStepper, this also sets the target position and stops the axis.</remarks>
+void FMStepperEngine::SetCurrentPosition(uint8_t axis, long position)
+{
+	Position[axis] = Target[axis] = position;
+	Halt(axis);
+}
+
+/// <summary>Set the maximum speed of an axis.</summary>
+/// <param name="axis">The axis.</param>
+/// <param name="speed">The maximum speed, in steps per second.</param>
+void FMStepperEngine::SetMaxSpeed(uint8_t axis, float speed)
+{
+	if (speed < 0)
+		speed = -speed;
+	if (speed == 0 || MaxSpeeds[axis] == speed)
+		return;
+	MaxSpeeds[axis] = speed;
+	Cmin[axis] = 1000000.0 / speed;
+	if (N[axis] > 0)
+	{
+		// recompute the position on the ramp for the new maximum
+		N[axis] = (long)((Speeds[axis] * Speeds[axis]) / (2.0 * Accel[axis]));
+		ComputeSpeed(axis);
+	}
+}
+
+/// <summary>Set the acceleration of an axis.</summary>
+/// <param name="axis">The axis.</param>
+/// <param name="accel">The acceleration, in steps per second per second.</param>
+void FMStepperEngine::SetAcceleration(uint8_t axis, float accel)
+{
+	if (accel < 0)
+		accel = -accel;
+	if (accel == 0 || Accel[axis] == accel)
+		return;
+	if (Accel[axis] != 0)
+		N[axis] = N[axis] * (Accel[axis] / accel);	// keep the same speed on the new ramp
+	C0[axis] = 0.676 * sqrt(2.0 / accel) * 1000000.0;
+	Accel[axis] = accel;
+	if (Target[axis] != Position[axis] || Speeds[axis] != 0)
+		ComputeSpeed(axis);
+}
+
+/// <summary>Stop an axis as quickly as possible using its current speed and acceleration.</summary>
+/// <param name="axis">The axis.</param>
+void FMStepperEngine::Stop(uint8_t axis)
+{
+	if (Speeds[axis] == 0)
+		return;
+	long stepsToStop = (long)((Speeds[axis] * Speeds[axis]) / (2.0 * Accel[axis])) + 1;
+	MoveTo(axis, Position[axis] + (Speeds[axis] > 0 ? stepsToStop : -stepsToStop));
+}
+
+/// <summary>Stop an axis immediately, without deceleration, where it is.</summary>
+/// <param name="axis">The axis.</param>
+void FMStepperEngine::Halt(uint8_t axis)
+{
+	Target[axis] = Position[axis];
+	Interval[axis] = 0;
+	Speeds[axis] = 0;
+	N[axis] = 0;
+}
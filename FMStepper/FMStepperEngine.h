@@ -0,0 +1,98 @@
+/*
+
+OOOOOOO OO   OO  OOOOO     O
+ OO  OO OOO OOO OO   OO   OO
+ OO   O OOOOOOO OO   OO   OO
+ OO O   OOOOOOO  OO     OOOOOO   OOOOO  OO OOO  OO OOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO     OO    OO   OO  OO  OO  OO  OO OO   OO  OO  OO
+ OO O   OO   OO     OO    OO    OOOOOOO  OO  OO  OO  OO OOOOOOO  OO  OO
+ OO     OO   OO OO   OO   OO    OO       OO  OO  OO  OO OO       OO
+ OO     OO   OO OO   OO   OO OO OO   OO  OOOOO   OOOOO  OO   OO  OO
+OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
+                                         OO      OO
+                                        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMStepperEngine_h
+#define _FMStepperEngine_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <Applet.h>
+
+/// <summary>An Applet stepping many stepper axes together from one timeline.</summary>
+/// <remarks>
+/// FMStepperEngine is intended for controllers driving many axes, where an AccelStepper and an Applet Run per axis
+/// cost too much. The state of every axis is kept in structure-of-arrays form, and each Run makes one pass over
+/// all the axes to find those due to step, producing a bitmask of the axes to step on this tick.
+/// Only the axes that step then have their speed updated, using the same acceleration algorithm as AccelStepper.
+/// Steps are scheduled from the time each step was due rather than the time it was taken, so a late tick doesn't
+/// slow the axis down, but no axis falls more than one step interval behind.
+/// The step bitmask and the direction bitmask are passed to an output function, which can write the step and
+/// direction pins of all the axes at once. Axes are limited to 64, the width of the bitmasks.
+/// FMStepper instances constructed on an axis of the engine act as views of that axis.
+/// </remarks>
+class FMStepperEngine : public Applet
+{
+public:
+	/// <summary>The maximum number of axes, the width of the step and direction bitmasks.</summary>
+	static const uint8_t MaxAxes = 64;
+
+	FMStepperEngine(char prefix, uint8_t axes, void (*output)(uint64_t steps, uint64_t directions) = NULL);
+	~FMStepperEngine();
+
+	void		Setup() { }
+	void		Run();
+	uint64_t	Tick(uint32_t now);
+
+	void		MoveTo(uint8_t axis, long position);
+	void		SetCurrentPosition(uint8_t axis, long position);
+	void		SetMaxSpeed(uint8_t axis, float speed);
+	void		SetAcceleration(uint8_t axis, float accel);
+	void		Stop(uint8_t axis);
+	void		Halt(uint8_t axis);
+
+	/// <summary>Get the current position of an axis, in steps.</summary>
+	long		CurrentPosition(uint8_t axis) { return Position[axis]; }
+	/// <summary>Get the target position of an axis, in steps.</summary>
+	long		TargetPosition(uint8_t axis) { return Target[axis]; }
+	/// <summary>Get the distance from the current to the target position of an axis, in steps.</summary>
+	long		DistanceToGo(uint8_t axis) { return Target[axis] - Position[axis]; }
+	/// <summary>Get the current speed of an axis, in steps per second, signed for direction.</summary>
+	float		Speed(uint8_t axis) { return Speeds[axis]; }
+	/// <summary>Get the maximum speed of an axis, in steps per second.</summary>
+	float		MaxSpeed(uint8_t axis) { return MaxSpeeds[axis]; }
+	/// <summary>Determine if an axis is still moving toward its target.</summary>
+	bool		Running(uint8_t axis) { return Speeds[axis] != 0 || Target[axis] != Position[axis]; }
+
+	uint8_t		Axes;				// the number of axes
+	uint64_t	StepDirections = 0;	// bitmask of the directions (1 = forward) for the steps of the last Tick
+	void		(*StepOutput)(uint64_t steps, uint64_t directions);	// function to output the steps of each Tick (or NULL)
+
+protected:
+	void		ComputeSpeed(uint8_t axis);
+
+	// the state of each axis, as a structure of arrays
+	int32_t*	Position;			// in steps - current position
+	int32_t*	Target;				// in steps - target position
+	uint32_t*	Interval;			// in microseconds - interval to the next step (0 if not stepping)
+	uint32_t*	NextStep;			// in microseconds - time the next step is due
+	float*		Speeds;				// in steps per second - current speed, signed for direction
+	float*		MaxSpeeds;			// in steps per second - maximum speed
+	float*		Accel;				// in steps per second per second - acceleration
+	int32_t*	N;					// step number on the acceleration ramp (negative while decelerating)
+	float*		C0;					// in microseconds - interval of the first step from rest
+	float*		Cn;					// in microseconds - interval of the last step
+	float*		Cmin;				// in microseconds - interval at the maximum speed
+	uint64_t	Forward = 0;		// bitmask of the axes moving forward
+	uint32_t	Now;				// in microseconds - time of the last Tick, on the clock it was given
+};
+
+#endif
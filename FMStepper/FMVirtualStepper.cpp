@@ -0,0 +1,70 @@
+/*
+
+OOOOOOO OO   OO  OOOOO     O
+ OO  OO OOO OOO OO   OO   OO
+ OO   O OOOOOOO OO   OO   OO
+ OO O   OOOOOOO  OO     OOOOOO   OOOOO  OO OOO  OO OOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO     OO    OO   OO  OO  OO  OO  OO OO   OO  OO  OO
+ OO O   OO   OO     OO    OO    OOOOOOO  OO  OO  OO  OO OOOOOOO  OO  OO
+ OO     OO   OO OO   OO   OO    OO       OO  OO  OO  OO OO       OO
+ OO     OO   OO OO   OO   OO OO OO   OO  OOOOO   OOOOO  OO   OO  OO
+OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
+                                         OO      OO
+                                        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#include "FMVirtualStepper.h"
+
+/// <summary>Take a commanded step, if the simulated motor is able to follow it.</summary>
+/// <remarks>The commanded position isn't used; the direction of movement is what matters.</remarks>
+void FMVirtualStepper::step(long)
+{
+	// time the step against the schedule, as FMAccelStepper does, without driving any outputs
+	uint32_t dt = Track();
+	// the interval the rotor actually sees, or the commanded interval if starting out from rest
+	float seconds = (RotorSpeed != 0 ? (dt != 0 ? dt : 1) : StepInterval()) / 1000000.0;
+	float dir = _direction == DIRECTION_CW ? 1 : -1;
+	float speed = dir / seconds;
+	// torque needed to reach that step rate within the interval, and the pull-out torque available at that rate
+	float torque = Inertia * fabs(speed - RotorSpeed) * StepAngle / seconds + LoadTorque;
+	float available = HoldingTorque * (1 - fabs(speed) / TopSpeed);
+	if (torque > PeakTorque)
+		PeakTorque = torque;
+	if (torque > available)
+	{
+		// the rotor can't keep up - the step is lost and the motor stalls
+		++MissedSteps;
+		Stalled = true;
+		RotorSpeed = 0;
+		return;
+	}
+	Stalled = false;
+	RotorSpeed = speed;
+	RotorPosition += (long)dir;
+}
+
+/// <summary>Read the simulated limit switch.</summary>
+/// <returns>True if the rotor is at or below the LimitPosition.</returns>
+/// <remarks>The limit switch pin isn't used.</remarks>
+bool FMVirtualStepper::LimitActive(int8_t)
+{
+	return RotorPosition <= LimitPosition;
+}
+
+/// <summary>Reset the simulation to rest at a given position.</summary>
+/// <param name="position">The position, in steps, for both the rotor and the commanded position.</param>
+/// <remarks>
+/// The statistics for missed steps and peak torque are cleared.
+/// </remarks>
+void FMVirtualStepper::Reset(long position)
+{
+	setCurrentPosition(position);
+	RotorPosition = position;
+	RotorSpeed = 0;
+	MissedSteps = 0;
+	Stalled = false;
+	PeakTorque = 0;
+}
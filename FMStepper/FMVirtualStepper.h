@@ -0,0 +1,81 @@
+/*
+
+OOOOOOO OO   OO  OOOOO     O
+ OO  OO OOO OOO OO   OO   OO
+ OO   O OOOOOOO OO   OO   OO
+ OO O   OOOOOOO  OO     OOOOOO   OOOOO  OO OOO  OO OOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO     OO    OO   OO  OO  OO  OO  OO OO   OO  OO  OO
+ OO O   OO   OO     OO    OO    OOOOOOO  OO  OO  OO  OO OOOOOOO  OO  OO
+ OO     OO   OO OO   OO   OO    OO       OO  OO  OO  OO OO       OO
+ OO     OO   OO OO   OO   OO OO OO   OO  OOOOO   OOOOO  OO   OO  OO
+OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
+                                         OO      OO
+                                        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+#ifndef _FMVirtualStepper_h
+#define _FMVirtualStepper_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include "arduino.h"
+#else
+	#include "WProgram.h"
+#endif
+
+#include <FMStepper.h>
+
+/// <summary>A simulated stepper motor and limit switch behind the AccelStepper step interface.</summary>
+/// <remarks>
+/// FMVirtualStepper stands in for a real AccelStepper, driver and motor so that FMStepper can be exercised
+/// without hardware, e.g. to sweep Acceleration and MaxSpeed settings before trying them on a rig.
+/// Each commanded step is checked against a simple model of the motor: the rotor and load inertia must be
+/// accelerated to the commanded step rate against a constant load torque, using no more than the pull-out
+/// torque available at that speed, which falls linearly from the holding torque at rest to nothing at TopSpeed.
+/// A step demanding more torque than that is missed: the rotor stays put and comes to rest.
+/// The rotor position also operates a simulated limit switch, closed at or below LimitPosition,
+/// which FMStepper reads in place of its limit pin.
+/// </remarks>
+class FMVirtualStepper : public FMAccelStepper
+{
+public:
+	/// <summary>Constructor.</summary>
+	/// <param name="stepAngle">The angle turned by one step, in degrees.</param>
+	/// <param name="inertia">The rotor inertia, plus any load inertia reflected to the rotor, in kg m^2.</param>
+	/// <param name="holdingTorque">The torque available at rest, in N m.</param>
+	/// <param name="topSpeed">The step rate at which no torque is available, in steps per second.</param>
+	/// <param name="loadTorque">The constant load (e.g. friction) torque opposing motion, in N m.</param>
+	FMVirtualStepper(float stepAngle, float inertia, float holdingTorque, float topSpeed, float loadTorque = 0) :
+		FMAccelStepper(AccelStepper::FUNCTION, 0, 0, 0, 0, false)
+	{
+		StepAngle = stepAngle * (float)DEG_TO_RAD;
+		Inertia = inertia;
+		HoldingTorque = holdingTorque;
+		TopSpeed = topSpeed;
+		LoadTorque = loadTorque;
+	}
+
+	bool		LimitActive(int8_t pin);
+	void		Reset(long position);
+
+	float		StepAngle;				// in radians - angle turned by one step
+	float		Inertia;				// in kg m^2 - rotor plus reflected load inertia
+	float		HoldingTorque;			// in N m - torque available at rest
+	float		TopSpeed;				// in steps per second - step rate at which no torque is available
+	float		LoadTorque;				// in N m - constant load torque opposing motion
+	long		LimitPosition = 0;		// in steps - rotor position at or below which the limit switch is closed
+
+	long		RotorPosition = 0;		// in steps - where the rotor actually is
+	uint32_t	MissedSteps = 0;		// number of commanded steps the rotor failed to follow
+	bool		Stalled = false;		// true if the most recent commanded step was missed
+	float		PeakTorque = 0;			// in N m - largest torque demanded by any commanded step
+
+protected:
+	void		step(long step);
+
+	float		RotorSpeed = 0;			// in steps per second, signed - rotor speed after the last step
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+
+OOOOOOO OO   OO  OOOOO     O
+ OO  OO OOO OOO OO   OO   OO
+ OO   O OOOOOOO OO   OO   OO
+ OO O   OOOOOOO  OO     OOOOOO   OOOOO  OO OOO  OO OOO   OOOOO  OO OOO
+ OOOO   OO O OO   OOO     OO    OO   OO  OO  OO  OO  OO OO   OO  OO  OO
+ OO O   OO   OO     OO    OO    OOOOOOO  OO  OO  OO  OO OOOOOOO  OO  OO
+ OO     OO   OO OO   OO   OO    OO       OO  OO  OO  OO OO       OO
+ OO     OO   OO OO   OO   OO OO OO   OO  OOOOO   OOOOO  OO   OO  OO
+OOOO    OO   OO  OOOOO     OOO   OOOOO   OO      OO      OOOOO  OOOO
+                                         OO      OO
+                                        OOOO    OOOO
+
+	(c) 2018 Scott Ferguson
+	This code is licensed under MIT license (see LICENSE file for details)
+*/
+
+/*
+Benchmark of FMStepperEngine::Tick() as the number of axes grows from 1 to 64.
+Every axis is set moving at a different speed, and the time for each Tick over all the axes is reported,
+along with the time per axis, on the debug output.
+*/
+
+#include <FMDebug.h>
+#include <FMStepperEngine.h>
+
+App		app;
+
+/// <summary>Time Ticks of an engine with all of its axes moving.</summary>
+/// <param name="axes">The number of axes.</param>
+void Benchmark(uint8_t axes)
+{
+	FMStepperEngine engine('#', axes);
+	for (uint8_t i = 0; i < axes; ++i)
+	{
+		engine.SetMaxSpeed(i, 1000 + 50 * i);
+		engine.SetAcceleration(i, 20000);
+		engine.MoveTo(i, 1000000L);
+	}
+
+	const uint32_t ticks = 20000;
+	uint32_t start = micros();
+	for (uint32_t t = 0; t < ticks; ++t)
+		engine.Tick(micros());
+	uint32_t elapsed = micros() - start;
+
+	// count the steps taken, to be sure the work was done
+	uint32_t steps = 0;
+	for (uint8_t i = 0; i < axes; ++i)
+		steps += engine.CurrentPosition(i);
+
+	debug.print(F("axes: "), axes);
+	debug.print(F("  us/tick: "), (double)elapsed / ticks, 3);
+	debug.print(F("  ns/axis: "), 1000.0 * elapsed / ticks / axes, 1);
+	debug.println(F("  steps: "), steps);
+	// the debug output only drains in the loop, so send each result before the next
+	fmDebug.Flush();
+}
+
+void setup()
+{
+	fmDebug.Init("Engine Benchmark", true);
+	app.AddApplet(&fmDebug);
+	for (uint8_t axes = 1; axes <= FMStepperEngine::MaxAxes; axes *= 2)
+		Benchmark(axes);
+}
+
+void loop()
+{
+	app.Run();
+}
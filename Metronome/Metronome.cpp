@@ -45,3 +45,17 @@ bool Micronome::Test()
 	LastTime = t;
 	return true;
 }
+
+/// <summary>Test for expiration of the timer interval on a fixed schedule.</summary>
+/// <returns>True if the timer interval has expired.</returns>
+/// <remarks>
+/// Unlike Test, the next interval starts when this one was due rather than when it was tested,
+/// so the intervals expire on an absolute schedule and lateness in polling doesn't accumulate.
+/// </remarks>
+bool Micronome::Next()
+{
+	if ((int32_t)(micros() - Due()) < 0)	// (safely across a micros() wrap)
+		return false;
+	LastTime += PeriodMicroS;
+	return true;
+}
@@ -73,6 +73,13 @@ public:
 	bool Test();
 	/// <summary>Restart the timer interval.</summary>
 	void Restart() { LastTime = micros(); }
+	/// <summary>Restart the timer so that the next interval expires at a specified time.</summary>
+	/// <param name="t">The system time, in microseconds, for the interval to expire.</param>
+	void RestartAt(uint32_t t) { LastTime = t - PeriodMicroS; }
+
+	bool Next();
+	/// <summary>Get the system time, in microseconds, at which the current interval expires.</summary>
+	uint32_t Due() { return LastTime + PeriodMicroS; }
 
 	/// <summary>Using the object as a boolean expression tests for expiration of the timer interval.</summary>
 	operator bool() { return Test(); }